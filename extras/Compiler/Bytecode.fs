@@ -1,14 +1,16 @@
 ﻿module Bytecode
 
 open System
+open System.Collections.Generic
 
 (* Below is everything having to do with Brief bytecode, AST, assembly, disassembly and lexing,
    parsing and compiling from source. Also the host-side dictionary.
 
    Below are all of the base Brief instructions. Any user-defined functions will be (User byte).
    Notice that most of them have no operands; instead taking parameters from the stack. The
-   exceptions are literals and Quote. A Word is a 16-bit subroutine address. The User
-   type is for user-defined instructions.
+   exceptions are literals, Quote and the superinstructions fusing a literal with the following
+   instruction. A Word is a 16-bit subroutine address. The User type is for user-defined
+   instructions.
 
    To understand the instruction set, refer to the VM implementation:
 
@@ -17,11 +19,15 @@ open System
 type Instruction =
     | Literal    of int16 // becomes lit8/16
     | Quote      of byte
+    | LiteralAdd of sbyte | LiteralFetch16 of byte | LiteralDigitalRead of byte // superinstructions
+    | DupMultiply | SwapSubtract | ZeroEqual
+    | ZeroBranch of sbyte | Branch of sbyte // relative to following instruction
     | Return
     | EventHeader | EventBody8 | EventBody16 | EventFooter | Event
     | Fetch8 | Store8
     | Fetch16 | Store16
     | Add | Subtract | Multiply | Divide | Modulus
+    | MultiplyDivide | MultiplyQ8 | MultiplyQ15 | AddSaturate | SubtractSaturate | Clamp // double-width
     | And | Or | ExclusiveOr
     | Shift
     | Equal | NotEqual | Greater | GreaterOrEqual | Less | LessOrEqual
@@ -42,6 +48,17 @@ type Instruction =
     | AttachISR | DetachISR
     | Milliseconds
     | PulseIn
+    | PinHandle | PinWrite | PinRead | PinToggle | PortRead | PortWrite // direct port I/O
+    | EventsDropped | SetTelemetry | Telemetry | FlushTelemetry | AttachDeferredISR
+    | SetTask | StopTask | YieldTask
+    | SetLoopPeriod | LoopStats | LoopStatsEvent | ResetLoopStats
+    | ResetProfile | DumpProfile
+    | Fill | Move | VectorSum | VectorMinMax | VectorDot | VectorAdd | VectorScale | Average | FIR
+    | Acquire | AcquireIndex | TelemetryBlock
+    | WireBegin | WireReadBlock | WireWriteBlock | WireReadRegisters
+    | WatchDigital | WatchAnalog | WatchThreshold | Unwatch
+    | Save | Restore | ForgetImage | ImageTag
+    | Budget | ResetTrace | DumpTrace | SetVector // extended instructions
     | Word of int16 * string
     | User of byte // user defined instruction
     | NoOperation
@@ -53,9 +70,12 @@ type Instruction =
    call. The address of the call is specific to the MCU. Another reason for MCU-specificity is that
    bytecode values may change depending on the order in which they're bound.
 
-   A "dictionary" is a simple Definition list. Various helper functions are provided to search the
-   dictionary and to add new definitions. Defintions may shadow existing ones (last one
-   defined becomes the first one found).
+   A "dictionary" is a set of Definitions, indexed by word, by Brief instruction and by reified
+   code. Various helper functions are provided to search the dictionary and to add new
+   definitions. Defintions may shadow existing ones (last one defined becomes the one found). Code is
+   indexed as it is reified (upon forcing through the dictionary), each sequence under the last
+   definition made of it; so disassembly (mapping calls back to words) needn't scan definitions.
+   The addresses bound to call vectors (see bindVectors below) are kept along with them.
 
    Upon lookup, these definitions may be simply returned as is, which is what happens when they are
    very short. A call is two bytes, so there is no reason to add definitions at the MCU for bytecode
@@ -74,39 +94,100 @@ type Definition = {
     Word  : string                // Brief word name
     Code  : Lazy<byte array> }    // on-demand code generator
 
-let find pred dict = List.tryFind pred (!dict)
-
-let findBrief brief = find (fun d -> d.Brief = Some brief)
-let findWord  word  = find (fun d -> d.Word  = word)
-let findCode  code  = find (fun d -> d.Code.IsValueCreated && d.Code.Value = code)
+type Definitions = {
+    Words  : Dictionary<string, Definition>             // last definition of each word
+    Briefs : Dictionary<Instruction, Definition>        // last definition of each instruction
+    Codes  : Dictionary<byte array, int * Definition>   // last reified definition of each code
+    Vectors : Dictionary<byte, int16>                   // address called by each vector call opcode
+    Fusions : Dictionary<string, int>                   // superinstructions fused (see fuse)
+    CallCounts : Dictionary<string, int>                // calls assembled to each word (see eagerAssemble)
+    mutable Count : int }                               // definitions made (ordering Codes)
+
+let newDictionary () =
+    { Words  = new Dictionary<string, Definition>()
+      Briefs = new Dictionary<Instruction, Definition>()
+      Codes  = new Dictionary<byte array, int * Definition>(HashIdentity.Structural)
+      Vectors = new Dictionary<byte, int16>()
+      Fusions = new Dictionary<string, int>()
+      CallCounts = new Dictionary<string, int>()
+      Count  = 0 }
+
+let clearDictionary dict =
+    dict.Words.Clear()
+    dict.Briefs.Clear()
+    dict.Codes.Clear()
+    dict.Vectors.Clear()
+    dict.Fusions.Clear()
+    dict.CallCounts.Clear()
+
+let find (index : Dictionary<'k, Definition>) key =
+    match index.TryGetValue key with
+    | true, def -> Some def
+    | _ -> None
+
+let findBrief brief dict = find dict.Briefs brief
+let findWord  word  dict = find dict.Words word
+let findCode  code  dict =
+    match dict.Codes.TryGetValue code with
+    | true, (_, def) -> Some def
+    | _ -> None
 
 let codeToWord dict call =
     match findCode call dict with
     | Some def -> def.Word
     | None -> failwith "Unrecognized bytecode sequence."
 
-let define dict brief word token code =
-    dict :=
+let define dict brief word token (code : Lazy<byte array>) =
+    let order = dict.Count
+    dict.Count <- order + 1
+    let self = ref None
+    let index code = // unless shadowed by a later definition of the same code
+        match dict.Codes.TryGetValue code with
+        | true, (later, _) when later > order -> ()
+        | _ -> dict.Codes.[code] <- (order, Option.get !self)
+    let def =
         { Brief = brief
           Word  = word
-          Code  = code } :: !dict
+          Code  = if code.IsValueCreated then code else lazy (let c = code.Force() in index c; c) }
+    self := Some def
+    if code.IsValueCreated then index code.Value
+    dict.Words.[word] <- def
+    Option.iter (fun b -> dict.Briefs.[b] <- def) brief
 
 (* Below is the Brief assembler. Here we convert Brief instruction sequences to bytecode. It's a
    pretty straightforward process. Notice that Literals become either two or three bytes depending
-   on the value. Future optimizations may include specific single-byte instructions for certain
-   values. Words become two-byte calls with the high bit set. There is a Call instruction but this
-   is for taking an address from the stack. Instead, this high-bit-scheme makes for very efficiently
-   packed subroutine threaded code.
+   on the value; except for the most common values (0, 1, 2 and -1) which have single-byte
+   instructions of their own. Words become two-byte calls with the high bit set. There is a Call
+   instruction but this is for taking an address from the stack. Instead, this high-bit-scheme makes
+   for very efficiently packed subroutine threaded code. The most called words may even be bound to
+   call vectors; becoming single-byte calls through a table at the MCU (see bindVectors below).
 
    In idiomatic Brief code, there are no branches. Instead we make use of quotations (the Quote
    instruction) and Choice and If for conditionals. This mechanism, along with subroutine calls,
-   is all that is needed for a fully expressive language. *)
+   is all that is needed for a fully expressive language. The ZeroBranch and Branch instructions
+   exist only as an optimization (see eagerAssemble below). *)
+
+let shortLiterals = [0s, 81uy; 1s, 82uy; 2s, 83uy; -1s, 84uy] // lit0, lit1, lit2, litNeg1
+
+let vectorBase = 85uy // VECTOR_CALL in firmware
+let callVectors = 8 // CALL_VECTORS in firmware
+
+let isVectorCall i = i >= vectorBase && i < vectorBase + byte callVectors
+
+let (|ShortLiteral|_|) x = shortLiterals |> List.tryFind (fst >> (=) x) |> Option.map snd // value to opcode
+let (|ShortLiteralOp|_|) i = shortLiterals |> List.tryFind (snd >> (=) i) |> Option.map fst // opcode to value
 
 let assembleBriefInstruction dict = function
+    | Literal (ShortLiteral i) -> [i]
     | Literal x ->
         if x >= -128s && x <= 127s then [1uy; byte x] // lit8 x
         else [2uy; x >>> 8 |> byte; byte x] // lit16 x
     | Quote x      -> [3uy; byte x]
+    | LiteralAdd x         -> [60uy; byte x] // lit8add x
+    | LiteralFetch16 x     -> [61uy; x] // lit8fetch16 x
+    | LiteralDigitalRead x -> [63uy; x] // lit8digitalread x
+    | ZeroBranch x -> [66uy; byte x]
+    | Branch x     -> [67uy; byte x]
     | Word (x, _)  -> [byte (x >>> 8) ||| 0x80uy; byte x]
     | NoOperation  -> []
     | User x       -> [x]
@@ -115,7 +196,69 @@ let assembleBriefInstruction dict = function
         | Some def -> def.Code.Force() |> List.ofArray
         | None -> failwith "Unrecognized Brief bytecode"
 
-let assembleBrief dict = List.map (assembleBriefInstruction dict) >> List.concat
+(* Common sequences are fused into superinstructions by a peephole pass over the assembled bytecode.
+   This saves dispatches at the MCU as well as dictionary space. Operands (of literals, quotations,
+   calls, ...) are skipped over so as not to be mistaken for instructions, and quotations and code
+   branched over are left alone because their contents were already fused as they were assembled
+   (and changing their length would invalidate the Quote or branch offset). Each fusion is counted
+   in the dictionary for reporting (cleared along with it). *)
+
+let hasOperand i = // lit8, next, superinstructions with operand, branches, extension or call
+    i = 1uy || i = 58uy || i = 60uy || i = 61uy || i = 63uy || i = 66uy || i = 67uy || i = 68uy || i &&& 0x80uy <> 0uy
+
+let fusionReport dict = dict.Fusions |> Seq.map (fun f -> f.Key, f.Value) |> List.ofSeq
+
+let (|Lit8|_|) = function // lit8 x or short literal (of 8-bit value)
+    | 1uy :: x :: t -> Some (x, t)
+    | ShortLiteralOp x :: t -> Some (byte x, t)
+    | _ -> None
+
+let fuse dict code =
+    let op brief =
+        match assembleBriefInstruction dict brief with
+        | [b] -> b
+        | _ -> failwith "Expected single-byte instruction"
+    let add, fetch16, read = op Add, op Fetch16, op DigitalRead
+    let dup, mul, swap, sub, eq = op Duplicate, op Multiply, op Swap, op Subtract, op Equal
+    let forward i n = (i = 66uy || i = 67uy) && n < 0x80uy // zbranch/branch forward
+    let width = function // of instruction at head of code
+        | 2uy :: _ -> 3
+        | 3uy :: n :: _ -> 2 + int n
+        | i :: _ :: _ when hasOperand i -> 2
+        | _ -> 1
+    let rec over n code = // split off n bytes of code branched over, extended by any branches within
+        if n <= 0 || List.isEmpty code then [], code
+        else
+            let w = width code
+            let i, t = List.splitAt (min w (List.length code)) code
+            let reach = match i with [b; m] when forward b m -> int m | _ -> 0
+            let body, rest = over (max (n - w) reach) t
+            i @ body, rest
+    let rec fuse' = function
+        | Lit8 (x, i :: t) when i = add -> fused "lit8 +" (LiteralAdd (sbyte x)) t
+        | Lit8 (a, i :: t) when i = fetch16 && a < 0x80uy -> fused "lit8 @" (LiteralFetch16 a) t
+        | 2uy :: 0uy :: a :: i :: t when i = fetch16 -> fused "lit16 @" (LiteralFetch16 a) t
+        | Lit8 (p, i :: t) when i = read && p < 0x80uy -> fused "lit8 digitalRead" (LiteralDigitalRead p) t
+        | 2uy :: 0uy :: p :: i :: t when i = read -> fused "lit16 digitalRead" (LiteralDigitalRead p) t
+        | Lit8 (0uy, i :: t) when i = eq -> fused "0 =" ZeroEqual t
+        | i :: j :: t when i = dup && j = mul -> fused "dup *" DupMultiply t
+        | i :: j :: t when i = swap && j = sub -> fused "swap -" SwapSubtract t
+        | 2uy :: a :: b :: t -> 2uy :: a :: b :: fuse' t // lit16
+        | 3uy :: n :: t -> // quotation
+            let body, rest = List.splitAt (min (int n) (List.length t)) t
+            3uy :: n :: body @ fuse' rest
+        | i :: n :: t when forward i n ->
+            let body, rest = over (int n) t
+            i :: n :: body @ fuse' rest
+        | i :: x :: t when hasOperand i -> i :: x :: fuse' t
+        | b :: t -> b :: fuse' t
+        | [] -> []
+    and fused name brief t =
+        dict.Fusions.[name] <- (match dict.Fusions.TryGetValue name with | true, n -> n + 1 | _ -> 1)
+        assembleBriefInstruction dict brief @ fuse' t
+    fuse' code
+
+let assembleBrief dict = List.map (assembleBriefInstruction dict) >> List.concat >> fuse dict
 
 (* For debugging and diagnostics, it is often useful to convert raw bytecode back to a list of
    Brief instructions. For subroutine calls, we even look up the name in the dictionary. We also
@@ -130,6 +273,20 @@ let disassembleBrief dict bytecode =
         |  1uy :: x      :: t -> Literal (x |> sbyte |> int16) |> recurse t
         |  2uy :: a :: b :: t -> Literal (unpackInt16 a b)     |> recurse t
         |  3uy :: x      :: t -> Quote (byte x)                |> recurse t
+        | 60uy :: x      :: t -> LiteralAdd (sbyte x)          |> recurse t
+        | 61uy :: x      :: t -> LiteralFetch16 x              |> recurse t
+        | 63uy :: x      :: t -> LiteralDigitalRead x          |> recurse t
+        | 66uy :: x      :: t -> ZeroBranch (sbyte x)          |> recurse t
+        | 67uy :: x      :: t -> Branch (sbyte x)              |> recurse t
+        | 68uy :: x      :: t -> // extension
+            (match findCode [|68uy; x|] dict with
+            | Some { Brief = Some brief } -> brief
+            | _ -> failwith "Unrecognized extended instruction") |> recurse t
+        | ShortLiteralOp x :: t -> Literal x                   |> recurse t
+        | v :: t when isVectorCall v -> // vector call
+            (match dict.Vectors.TryGetValue v with
+            | true, addr -> Word (addr, codeToWord dict [|v|])
+            | _ -> failwith "Unbound call vector") |> recurse t
         | a :: b :: t when a &&& 0x80uy <> 0uy -> // call
             let addr = unpackInt16 (a &&& 0x7Fuy) b
             let word = codeToWord dict [|a; b|]
@@ -148,6 +305,14 @@ let printBrief dict b = // Brief to 'words'
     let rec print = function
         | Literal x      -> sprintf "%i" x
         | Quote x        -> sprintf "(quote %i)" x
+        | LiteralAdd x         -> sprintf "%i +" x
+        | LiteralFetch16 x     -> sprintf "%i @" x
+        | LiteralDigitalRead x -> sprintf "%i digitalRead" x
+        | DupMultiply    -> "dup *"
+        | SwapSubtract   -> "swap -"
+        | ZeroEqual      -> "0 ="
+        | ZeroBranch x   -> sprintf "(zbranch %i)" x
+        | Branch x       -> sprintf "(branch %i)" x
         | Word (_, name) -> name
         | NoOperation    -> failwith "NoOperation should not exist in assembled code"
         | User x         ->
@@ -160,6 +325,152 @@ let printBrief dict b = // Brief to 'words'
             | None -> sprintf "(unknown %A)" brief
     b |> List.map print
 
+(* A profile dumped by a profiling build of the firmware (PROFILE) is made up of execution counts per
+   opcode along with call counts and time (inclusive, in PROFILE_CLOCK units) per word address. These
+   are mapped back to names through the dictionary; busiest first. *)
+
+let opcodeName dict op =
+    match op, findCode [|op|] dict with
+    | ShortLiteralOp x, _ -> sprintf "(lit %i)" x
+    | _, Some def -> def.Word
+    | 1uy, None -> "(lit8)"
+    | 2uy, None -> "(lit16)"
+    | 3uy, None -> "(quote)"
+    | _ -> sprintf "(opcode %i)" op
+
+let wordName dict addr =
+    match findCode [|0x80uy ||| byte (addr >>> 8); byte addr|] dict with
+    | Some def -> def.Word
+    | None -> sprintf "(word %i)" addr
+
+let profileReport dict (ops : (byte * int) list) (words : (int * int * uint32) list) =
+    let opName = opcodeName dict
+    let wordName = wordName dict
+    [ yield "Opcodes (executions):"
+      for (op, n) in List.sortBy (snd >> (~-)) ops ->
+          sprintf "  %s: %i" (opName op) n
+      yield "Words (calls, time):"
+      for (addr, n, t) in List.sortBy (fun (_, n, t) -> -(int64 t), -n) words ->
+          sprintf "  %s: %i, %i" (wordName addr) n t ]
+
+(* A trace dumped by a tracing build of the firmware (TRACE) is the tail of the instructions executed;
+   records of address, opcode (or high byte of a call) and top of stack, along with the time (in
+   TRACE_CLOCK units) since the previous record when timed. From these the call tree is rebuilt. A call
+   (or a quotation run by call, choice or if) is followed by the first instruction of the callee and a
+   return by the instruction returned to. Frames are matched up by return address, so a tail call (which
+   pushes none) returns along with its caller. Code continuing out of context (the start of the ring, a
+   new run of the loop word, a task resuming, ...) begins a new root at the word containing it. Quotations
+   appear as [word] where word is that containing them.
+
+   The time of each instruction (that recorded with the next) is charged to the word running it
+   (exclusive) and to it and its callers (inclusive); but not across the end of a run. Words are ordered
+   by inclusive time, counted once per word however deeply it recurses. The last instructions executed
+   are listed too, disassembled through the dictionary (operands aren't recorded). Addresses at or
+   above last and below any flash image are of immediate code. *)
+
+type TraceNode = { // word called along a path in the call tree (or totals for the word)
+    Name : string
+    Children : ResizeArray<TraceNode>
+    mutable Calls : int
+    mutable Inclusive : int64
+    mutable Exclusive : int64 }
+
+let traceReport dict last timed (records : (int * byte * int * int) list) =
+    let records = Array.ofList records
+    let starts = // of words (reified)
+        dict.Codes.Keys
+        |> Seq.filter (fun c -> c.Length = 2 && c.[0] &&& 0x80uy <> 0uy)
+        |> Seq.map (fun c -> (int (c.[0] &&& 0x7Fuy) <<< 8) ||| int c.[1])
+        |> Seq.sort |> Array.ofSeq
+    let locate p = // word containing address and offset within it
+        match Array.tryFindBack (fun s -> s <= p) starts with
+        | Some s when s >= last || p < last -> wordName dict s, p - s
+        | _ when p >= last && last > 0 -> "(immediate)", p - last
+        | _ -> sprintf "(code %i)" p, 0
+    let instruction k = // name of kth instruction
+        match records.[k] with
+        | _, op, _, _ when op &&& 0x80uy <> 0uy || isVectorCall op ->
+            if k + 1 < records.Length then let a, _, _, _ = records.[k + 1] in wordName dict a else "(call)"
+        | _, 1uy, _, _ -> "(lit8)"
+        | _, 2uy, _, _ -> "(lit16)"
+        | _, 3uy, _, _ -> "(quote)"
+        | _, 58uy, _, _ -> "(next)"
+        | _, 60uy, _, _ -> "(lit8 +)"
+        | _, 61uy, _, _ -> "(lit8 @)"
+        | _, 63uy, _, _ -> "(lit8 digitalRead)"
+        | _, 66uy, _, _ -> "(zbranch)"
+        | _, 67uy, _, _ -> "(branch)"
+        | _, 68uy, _, _ -> "(extension)"
+        | _, op, _, _ -> disassembleBrief dict [|op|] |> printBrief dict |> List.head
+    let node name = { Name = name; Children = ResizeArray(); Calls = 0; Inclusive = 0L; Exclusive = 0L }
+    let root = node ""
+    let totals = new Dictionary<string, TraceNode>()
+    let total name =
+        match totals.TryGetValue name with
+        | true, n -> n
+        | _ -> let n = node name in totals.[name] <- n; n
+    let stack = ref [] // frames (node, return address), innermost first
+    let enter name ret =
+        let parent = match !stack with (n, _) :: _ -> n | [] -> root
+        let n =
+            match Seq.tryFind (fun c -> c.Name = name) parent.Children with
+            | Some c -> c
+            | None -> let c = node name in parent.Children.Add(c); c
+        n.Calls <- n.Calls + 1
+        (total name).Calls <- (total name).Calls + 1
+        stack := (n, ret) :: !stack
+    let restart p = stack := []; enter (fst (locate p)) -1
+    let charge d =
+        match !stack with
+        | (n, _) :: _ ->
+            n.Exclusive <- n.Exclusive + d
+            (total n.Name).Exclusive <- (total n.Name).Exclusive + d
+            for (n, _) in !stack do n.Inclusive <- n.Inclusive + d
+            for name in !stack |> List.map (fun (n, _) -> n.Name) |> List.distinct do
+                (total name).Inclusive <- (total name).Inclusive + d
+        | [] -> ()
+    if records.Length > 0 then (let a, _, _, _ = records.[0] in restart a)
+    for k in 0 .. records.Length - 2 do
+        let a, op, _, _ = records.[k]
+        let a', _, _, d = records.[k + 1]
+        let within () = fst (locate a) = fst (locate a')
+        let quotation () = enter (sprintf "[%s]" (fst (locate a'))) (a + 1)
+        let continues =
+            match op with
+            | _ when op &&& 0x80uy <> 0uy || isVectorCall op -> true // call
+            | 0uy -> List.exists (fun (_, r) -> r = a') !stack // return (otherwise end of run)
+            | 42uy | 43uy | 44uy -> true // call, choice, if
+            | 58uy | 66uy | 67uy -> within () // next, zbranch, branch
+            | _ -> a' > a && within ()
+        if continues then
+            charge (int64 d)
+            match op with
+            | _ when op &&& 0x80uy <> 0uy -> enter (wordName dict a') (a + 2)
+            | _ when isVectorCall op -> enter (wordName dict a') (a + 1)
+            | 0uy -> stack := !stack |> List.skipWhile (fun (_, r) -> r <> a') |> List.tail
+            | 42uy | 43uy -> quotation ()
+            | 44uy when a' <> a + 1 -> quotation () // taken
+            | _ -> ()
+        else restart a'
+    let times (n : TraceNode) = if timed then sprintf ", %i, %i" n.Inclusive n.Exclusive else ""
+    let rec tree depth (n : TraceNode) = seq {
+        yield sprintf "%s%s: %i%s" (String(' ', depth * 2)) n.Name n.Calls (times n)
+        for c in n.Children do yield! tree (depth + 1) c }
+    [ yield sprintf "Trace (%i instructions):" records.Length
+      yield if timed then "Call tree (calls, inclusive, exclusive):" else "Call tree (calls):"
+      for n in root.Children do yield! tree 1 n
+      yield if timed then "Words (calls, inclusive, exclusive):" else "Words (calls):"
+      for n in totals.Values |> Seq.sortBy (fun n -> -n.Inclusive, -n.Calls) ->
+          sprintf "  %s: %i%s" n.Name n.Calls (times n)
+      yield if timed then "Last instructions (top of stack, time):" else "Last instructions (top of stack):"
+      for k in max 0 (records.Length - 16) .. records.Length - 1 ->
+          let a, _, tos, _ = records.[k]
+          let name, offset = locate a
+          let time =
+              if timed && k + 1 < records.Length then let _, _, _, d = records.[k + 1] in sprintf ", %i" d
+              else ""
+          sprintf "  %s+%i: %s (%i%s)" name offset (instruction k) tos time ]
+
 (* Below is everything needed to lex/parse/compile Brief source.
 
    The lexer is quite simple! For the most part, tokens are plainly whitespace separated. The
@@ -242,14 +553,49 @@ let parse source =
    assembled straightforwardly. Quotations have a special case when they contain a single Word.
    In this case, we emit the Word address directly rather than a Quote 1 Word Return; saving a few
    bytes and also making expressions like 'foo setLoop valid for immediate execution (otherwise
-   you'd be setting a temporarily allocated anonymous quotation address as the loop word. *)
+   you'd be setting a temporarily allocated anonymous quotation address as the loop word.
+
+   Literal quotations consumed directly by choice or if are instead laid out inline and jumped
+   around with ZeroBranch/Branch:
+
+       [t] [f] choice  becomes  (zbranch len(t)+2) t (branch len(f)) f
+       [t] if          becomes  (zbranch len(t)) t
+
+   This saves the Quote, the call and the return at the MCU. Quotations making use of the return
+   stack (an early return, pop, peek or next) or too long to reach with an 8-bit offset are left
+   as quotations.
+
+   Calls assembled (two-byte or through a call vector) are counted per word in the dictionary, for
+   reporting; the words called from the most places being those worth binding to call vectors. *)
+
+let inlinable (code : byte array) extra =
+    let rec usesReturn = function
+        | i :: _ when i = 0uy || i = 39uy || i = 40uy || i = 58uy -> true // return, popr, peekr or next
+        | i :: n :: t when i = 3uy || i = 66uy || i = 67uy -> // skip quotation or branch operand
+            if i = 3uy then t |> List.skip (min (int n) (List.length t)) |> usesReturn else usesReturn t
+        | i :: _ :: t when hasOperand i -> usesReturn t
+        | 2uy :: _ :: _ :: t -> usesReturn t
+        | _ :: t -> usesReturn t
+        | [] -> false
+    code.Length + extra <= 127 && code |> List.ofArray |> usesReturn |> not
+
+let callReport dict = dict.CallCounts |> Seq.map (fun c -> c.Key, c.Value) |> List.ofSeq
 
 let eagerAssemble dict parsed =
+    let called tok = dict.CallCounts.[tok] <- (match dict.CallCounts.TryGetValue tok with | true, n -> n + 1 | _ -> 1)
+    let primitive tok brief =
+        match findWord tok dict with
+        | Some def -> def.Brief = Some brief
+        | None -> false
     let rec assemble' bytecode = function
         | Token tok :: t ->
             match findWord tok dict with
             | Some word ->
                 let code = word.Code.Force() |> List.ofSeq
+                match code with
+                | [a; _] when a &&& 0x80uy <> 0uy -> called tok
+                | [v] when isVectorCall v -> called tok
+                | _ -> ()
                 assemble' (code :: bytecode) t
             | None -> sprintf "Unrecognized token: %s" tok |> failwith
         | Address addr :: t ->
@@ -258,14 +604,28 @@ let eagerAssemble dict parsed =
         | Number n :: t -> assemble' (assembleBrief dict [Literal n] :: bytecode) t
         | Quotation quote :: t ->
             let q = assemble' [] quote
-            match disassembleBrief dict q with
-            | [Word (addr, _)] -> // special case for single secondary
-                assemble' (assembleBrief dict [Literal addr] :: bytecode) t // emit address directly
-            | _ ->
-                let q' = assembleBrief dict [Quote (1 + Array.length q |> byte)]
-                let ret = assembleBrief dict [Return]
-                assemble' (ret :: (q' @ List.ofArray q) :: bytecode) t
-        | [] -> bytecode |> List.rev |> List.concat |> Array.ofList
+            match t with
+            | Token tok :: t' when primitive tok If && inlinable q 0 ->
+                let skip = assembleBrief dict [ZeroBranch (sbyte q.Length)]
+                assemble' ((skip @ List.ofArray q) :: bytecode) t'
+            | Quotation quote' :: Token tok :: t' when primitive tok Choice ->
+                let f = assemble' [] quote'
+                if inlinable q 2 && inlinable f 0 then
+                    let skipTrue = assembleBrief dict [ZeroBranch (q.Length + 2 |> sbyte)]
+                    let skipFalse = assembleBrief dict [Branch (sbyte f.Length)]
+                    assemble' ((skipTrue @ List.ofArray q @ skipFalse @ List.ofArray f) :: bytecode) t'
+                else
+                    let choice = assembleBrief dict [Choice]
+                    assemble' (choice :: quotation f :: quotation q :: bytecode) t'
+            | _ -> assemble' (quotation q :: bytecode) t
+        | [] -> bytecode |> List.rev |> List.concat |> fuse dict |> Array.ofList
+    and quotation q =
+        match disassembleBrief dict q with
+        | [Word (addr, _)] -> assembleBrief dict [Literal addr] // special case for single secondary
+        | _ ->
+            let q' = assembleBrief dict [Quote (1 + Array.length q |> byte)]
+            let ret = assembleBrief dict [Return]
+            q' @ List.ofArray q @ ret
     assemble' [] parsed
 
 let eagerCompile dict = parse >> eagerAssemble dict
@@ -308,6 +668,81 @@ let lazyCompile dict source = lazyGenerate dict (fun () -> eagerCompile dict sou
 
 let lazyAssemble dict ast = lazyGenerate dict (fun () -> eagerAssemble dict ast)
 
+(* The most called words may be bound to call vectors; a small table at the MCU (CALL_VECTORS
+   entries) indexed by single-byte vector call instructions, halving the size of each call. Binding
+   gives the code to be executed at the MCU (setting the table; after the definitions pending have
+   been sent) and redefines each word as its vector call, so that code assembled from then on calls
+   through the vector. Code already assembled keeps the two-byte calls.
+
+   The words are all reified before any is bound; so that no definition sent down calls through a
+   vector not yet set (the firmware's verifier rejecting such code). Words inlined rather than
+   called, or bound already, are left as they are. Vectors are allocated in order and not reused;
+   `callReport` above telling which words are called from the most places. *)
+
+let bindVectors dict words =
+    let reify word =
+        match findWord word dict with
+        | Some def -> def, def.Code.Force()
+        | None -> sprintf "Unrecognized word: %s" word |> failwith
+    let bind (def, code) =
+        match code with
+        | [|a; b|] when a &&& 0x80uy <> 0uy ->
+            if dict.Vectors.Count >= callVectors then failwith "Out of call vectors"
+            let v = vectorBase + byte dict.Vectors.Count
+            let addr = int16 (a &&& 0x7Fuy) <<< 8 ||| int16 b
+            dict.Vectors.[v] <- addr
+            define dict def.Brief def.Word None (Lazy<byte array>.CreateFromValue [|v|])
+            [Literal addr; Literal (int16 (v - vectorBase)); SetVector]
+        | _ -> [] // inlined or bound already
+    words |> List.ofSeq |> List.distinct |> List.map reify |> List.collect bind |> assembleBrief dict |> Array.ofList
+
+(* Stable library words may instead be baked into the firmware and executed in place from flash (ROM
+   in the firmware) at and above ROM_BASE, leaving the RAM dictionary for everything else. An image is
+   made by reifying the given words with the address starting at the flash region; the definitions
+   that would have been sent down are collected as the image rather than pending. The dictionary
+   keeps the calls into flash, so that only the address need be rewound to RAM afterward. This is to
+   be done to a fresh dictionary (words already reified stay where they are) and only code words
+   belong there; variables in flash are read only.
+
+   The image is emitted as a C header (romHeader) to be compiled into the firmware and given to
+   `brief::rom()`. The same words baked in the same order give the same image, so a later session need
+   only bake them again (without flashing) to know the addresses. *)
+
+let romBase = 0x4000 // ROM_BASE in firmware
+
+let romImage dict address pending words =
+    let ram = !address
+    address := romBase
+    let reify word =
+        match findWord word dict with
+        | Some def -> def.Code.Force() |> ignore
+        | None -> sprintf "Unrecognized word: %s" word |> failwith
+    Seq.iter reify words
+    let image = !pending |> Array.ofSeq
+    address := ram
+    pending := Seq.empty
+    if romBase + image.Length > 0x8000 then failwith "Image exceeds 15-bit address space"
+    image
+
+let romHeader (image : byte array) =
+    if image.Length = 0 then failwith "Empty image (nothing to bake)"
+    let rows =
+        image
+        |> Array.chunkBySize 16
+        |> Array.map (fun row -> "    " + (row |> Array.map (sprintf "0x%02x,") |> String.concat " "))
+        |> List.ofArray
+    ["/* BriefROM.h (generated by the Brief compiler, do not edit)"
+     ""
+     sprintf "Library words (%i bytes) executed in place from flash at ROM_BASE. Register with" image.Length
+     "`brief::rom(briefROM, sizeof(briefROM))` before `brief::setup()`. */"
+     ""
+     sprintf "#if !ROM || ROM_BASE != 0x%04x" romBase
+     sprintf "#error \"Image built for flash region at 0x%04x (ROM_BASE)\"" romBase
+     "#endif"
+     ""
+     "const uint8_t briefROM[] PROGMEM = {"] @ rows @ ["};"; ""]
+    |> String.concat "\n"
+
 (* Below is a function to initialize a dictionary with mappings for all of the Brief primitives
    as well as a library of useful words which can be thought of as being part of the language. *)
 
@@ -368,7 +803,67 @@ let initDictionary dict address pending =
          AttachISR,             "attachISR",             54  // addr i mode -
          DetachISR,             "detachISR",             55  // i           -
          Milliseconds,          "milliseconds",          56  //             - millis
-         PulseIn,               "pulseIn",               57] // val pin     - duration
+         PulseIn,               "pulseIn",               57  // val pin     - duration
+         DupMultiply,           "(dup*)",                62  // x           - x*x
+         SwapSubtract,          "(swap-)",               64  // y x         - x-y
+         ZeroEqual,             "(0=)",                  65  // x           - pred
+         MultiplyDivide,        "*/",                    69  // a b c       - a*b/c
+         MultiplyQ8,            "q8*",                   70  // y x         - prod (Q8.8)
+         MultiplyQ15,           "q15*",                  71  // y x         - prod (Q1.15)
+         AddSaturate,           "+sat",                  72  // y x         - sum
+         SubtractSaturate,      "-sat",                  73  // y x         - diff
+         Clamp,                 "clamp",                 74  // x lo hi     - x
+         PinHandle,             "pinHandle",             75  // pin         - handle
+         PinWrite,              "pinWrite",              76  // val handle  -
+         PinRead,               "pinRead",               77  // handle      - val
+         PinToggle,             "pinToggle",             78  // handle      -
+         PortRead,              "portRead",              79  // handle      - bits
+         PortWrite,             "portWrite",             80] // bits mask handle -
+
+    let defineExtension (b, w, c) = define dict (Some b) w None (lazy [|68uy; byte c|])
+    List.iter defineExtension
+        [EventsDropped,         "eventsDropped",         0   //             - count
+         SetTelemetry,          "setTelemetry",          1   // n bytes ms  -
+         Telemetry,             "telemetry",             2   // x1 .. xn    -
+         FlushTelemetry,        "flushTelemetry",        3   //             -
+         AttachDeferredISR,     "attachDeferredISR",     4   // addr i mode -
+         SetTask,               "setTask",               5   // addr ms i   -
+         StopTask,              "stopTask",              6   // i           -
+         YieldTask,             "yield",                 7   //             -
+         SetLoopPeriod,         "setLoopPeriod",         8   // us          -
+         LoopStats,             "loopStats",             9   //             - min max mean jitter overruns
+         LoopStatsEvent,        "loopStatsEvent",        10  //             -
+         ResetLoopStats,        "resetLoopStats",        11  //             -
+         ResetProfile,          "resetProfile",          12  //             -
+         DumpProfile,           "dumpProfile",           13  //             -
+         Fill,                  "fill",                  14  // val addr n  -
+         Move,                  "move",                  15  // src dst n   -
+         VectorSum,             "vectorSum",             16  // addr n      - sum
+         VectorMinMax,          "vectorMinMax",          17  // addr n      - min max
+         VectorDot,             "vectorDot",             18  // a b n       - sum
+         VectorAdd,             "vectorAdd",             19  // a b dst n   -
+         VectorScale,           "vectorScale",           20  // a k dst n   -
+         Average,               "average",               21  // x ring n    - mean
+         FIR,                   "fir",                   22  // x ring taps n - y
+         Acquire,               "acquire",               23  // chans n ring frames us -
+         AcquireIndex,          "acquireIndex",          24  //             - index
+         TelemetryBlock,        "telemetryBlock",        25  // addr records -
+         WireBegin,             "wireBegin",             26  //             -
+         WireReadBlock,         "wireReadBlock",         27  // addr n dev  - count
+         WireWriteBlock,        "wireWriteBlock",        28  // addr n dev  - status
+         WireReadRegisters,     "wireReadRegisters",     29  // addr n reg dev - count
+         WatchDigital,          "watchDigital",          30  // pin mode id -
+         WatchAnalog,           "watchAnalog",           31  // pin band id -
+         WatchThreshold,        "watchThreshold",        32  // pin level hyst id -
+         Unwatch,               "unwatch",               33  // pin         -
+         Save,                  "save",                  34  // tag         -
+         Restore,               "restore",               35  //             -
+         ForgetImage,           "forgetImage",           36  //             -
+         ImageTag,              "imageTag",              37  //             -
+         Budget,                "budget",                38  // n us        -
+         ResetTrace,            "resetTrace",            39  //             -
+         DumpTrace,             "dumpTrace",             40  //             -
+         SetVector,             "setVector",             41] // addr slot   -
 
     let library (w, d) = lazyCompile dict d address pending |> define dict None w None
     List.iter library
@@ -3,6 +3,8 @@
 open System
 open System.IO.Ports
 open System.Threading
+open System.Diagnostics
+open System.Collections.Concurrent
 open Bytecode
 
 (* Below is a class meant to be used in C#-land. As such we give a little object wrapper with
@@ -20,14 +22,23 @@ open Bytecode
 
    The Define methods have the side effect of adding lazy definitions to the dictionary. These may
    later be reified implicitly and returned as definitions to send down when depending code is
-   reified. *)
+   reified.
+
+   The ROM method bakes library words into flash instead; returning the image (ROMHeader rendering
+   it as a C header for the firmware build). The words remain baked across Reset.
+
+   The Vectors method binds the given words to call vectors (single-byte calls); returning, as the
+   Eager* methods do, the definitions to send down and the code setting the vectors at the MCU. Calls
+   gives the count of calls assembled to each word; telling which are worth binding. *)
 
 open System.Reflection
 
+[<AllowNullLiteral>]
 type Compiler() =
-    let dict = ref []
+    let dict = newDictionary ()
     let address = ref 0
     let pending = ref Seq.empty
+    let romWords = ref [] // library words baked into flash (see ROM)
 
     let getPending () =
         let p = !pending |> Array.ofSeq
@@ -35,9 +46,17 @@ type Compiler() =
 
     let token (memb : MemberInfo) = Some (memb.Module.FullyQualifiedName, memb.MetadataToken)
 
-    do initDictionary dict address pending
+    let reset () = // fresh dictionary, knowing words in flash (if any)
+        clearDictionary dict; address := 0; pending := Seq.empty
+        initDictionary dict address pending
+        romImage dict address pending !romWords
+
+    do reset () |> ignore
+
+    member x.Reset() = reset () |> ignore
 
-    member x.Reset() = dict := []; address := 0; pending := Seq.empty; initDictionary dict address pending
+    member x.ROM(words : string seq) = romWords := List.ofSeq words; reset () // image of words baked into flash
+    member x.ROMHeader(image) = romHeader image
 
     member x.EagerCompile(source) = eagerCompile   dict source, getPending ()
     member x.EagerAssemble(ast)   = eagerAssemble  dict ast,    getPending ()
@@ -56,70 +75,475 @@ type Compiler() =
 
     member x.Address = !address
 
+    member x.Fusions = fusionReport dict
+
+    member x.Calls = callReport dict
+
+    member x.Vectors(words : string seq) = bindVectors dict words, getPending ()
+
+    member x.ProfileReport(ops, words) = profileReport dict ops words
+
+    member x.TraceReport(timed, records) = traceReport dict !address timed records
+
     member x.Disassemble(bytecode) =
         bytecode
         |> disassembleBrief dict
         |> printBrief dict
         |> List.map ((+) " ") |> List.reduce (+)
 
-type Communication(eventFn : Action<string>, traceFn: Action<bool, byte[]>) =
+(* Communication optionally takes the Compiler whose dictionary is used to name opcodes and words in
+   profile and trace reports.
+
+   Frames may be captured rather than sent (Capture); e.g. to find what a library would upload and
+   tag it (Tag, a CRC-16 of the frames) before deciding whether to send it at all. The tag of the
+   image saved at the MCU (if any) is reported by the imageTag instruction (QueryImage). A matching
+   image need only be restored at the MCU rather than uploaded again.
+
+   Frames are normally sent blind. Given a Window, they are instead sent as sequenced frames (see the
+   firmware's `loop()`), each checked by CRC and acknowledged by the MCU. Up to Window frames are kept
+   in flight; SendBytes blocks only once the window is full. Upon a negative acknowledgement (or no
+   acknowledgement within AckTimeout) the frames in flight are resent from the oldest (go-back-N; the
+   MCU takes frames strictly in order, into the dictionary as they arrive, and so can't hold on to the
+   ones following a loss). Sequenced frames may be longer than 127 bytes. Flush waits for everything
+   in flight to be acknowledged.
+
+   Events are read in chunks into pooled batches and parsed in place; each batch holding the offsets
+   of the events within the chunk rather than copies. Link events (acknowledgements, boot and image
+   tags) are acted upon straight away on the read thread. The batches are queued for the consumer to
+   take at its own pace (TakeEvents) and hand back (Recycle) when done, so that a steady stream of
+   events allocates nothing. Given an eventFn, batches are instead taken by a thread of its own,
+   describing each event to eventFn (from Connect until Disconnect, having described those queued). Should the consumer fall behind by more than a queue's worth of
+   batches, further events are dropped (and counted) rather than holding up the read thread.
+   ReaderStats gives counts of what has been read, parsed, queued and dropped. An I/O error on the open
+   port (e.g. the device unplugged) stops the reader, and is given as the Fault in ReaderStats (and to
+   eventFn) rather than escaping the read thread. *)
+
+[<AllowNullLiteral>]
+type EventBatch(size : int) = // events (length, id, data) parsed in place in chunk read
+    let buffer = Array.zeroCreate<byte> size
+    let offsets = Array.zeroCreate<int> (size / 2) // of each event within buffer (at least two bytes each)
+    let mutable count = 0
+    member x.Count = count
+    member x.Id(i) = buffer.[offsets.[i] + 1]
+    member x.Data(i) = ArraySegment<byte>(buffer, offsets.[i] + 2, int buffer.[offsets.[i]])
+    member internal x.Buffer = buffer
+    member internal x.Add(offset) = offsets.[count] <- offset; count <- count + 1
+    member internal x.Clear() = count <- 0
+
+type ReaderStats = {
+    Bytes : int64          // bytes read
+    Events : int64         // events parsed (acknowledgements aside)
+    Batches : int64        // batches queued
+    Dropped : int64        // events dropped (queue full)
+    Backlog : int          // events queued and not yet taken
+    BacklogBatches : int   // batches queued and not yet taken
+    ParseSeconds : float   // time spent parsing (throughput being Events / ParseSeconds)
+    Fault : string option } // I/O error that stopped the reader (port open but no longer read)
+
+type Communication(eventFn : Action<string>, traceFn: Action<bool, byte[]>, compiler : Compiler) =
+    static let crc16 crc (b : byte) = // CRC-16/CCITT (as the firmware's)
+        Seq.fold (fun (c : uint16) _ -> if c &&& 0x8000us <> 0us then (c <<< 1) ^^^ 0x1021us else c <<< 1)
+            (crc ^^^ (uint16 b <<< 8)) [1 .. 8]
     let (serial : SerialPort option ref) = ref None
-    let rec readEvents () =
-        let event message = if eventFn <> null then eventFn.Invoke(message)
-        match !serial with
-        | Some port ->
-            if port.IsOpen && port.BytesToRead > 0 then
-                let len = port.ReadByte()
-                let id = port.ReadByte() |> byte
-                let data = Array.create len 0uy
-                port.Read(data, 0, len) |> ignore
-                let toInt d =
-                    match Array.length d with
-                    | 0 -> 0s
-                    | 1 -> d.[0] |> sbyte |> int16
-                    | 2 -> (int16 d.[0] <<< 8) ||| int16 d.[1]
-                    | _ -> failwith "Invalid event data."
-                match id with
-                | id when id = 0xF0uy -> data |> toInt |> sprintf "%i" |> event
-                | 0xFFuy -> event "Boot event"
-                | 0xFEuy ->
-                    sprintf "VM Error: %s"
-                        (match data with
-                        | [|0uy|] -> "Return stack underflow"
-                        | [|1uy|] -> "Return stack overflow"
-                        | [|2uy|] -> "Data stack underflow"
-                        | [|3uy|] -> "Data stack overflow"
-                        | [|4uy|] -> "Out of memory"
-                        | _ -> "Unknown") |> event
-                | _ -> sprintf "Event (%i): %A" id data |> event
-        | None -> ()
-        Thread.Sleep(100)
-        readEvents ()
+    let (captured : (bool * byte array) list option ref) = ref None // frames captured rather than sent
+    let (imageTag : uint16 option ref) = ref None // tag of image saved at MCU (as last reported)
+    let imageReported = new AutoResetEvent(false)
+    let window = ref 0 // sequenced frames kept in flight (0 for plain frames sent blind)
+    let ackTimeout = ref 1000 // milliseconds awaiting acknowledgement before resending
+    let (inFlight : (int * bool * byte array * bool) list ref) = ref [] // sequence, execute, code, sync (oldest first)
+    let sequence = ref 0 // of next sequenced frame
+    let sync = ref true // whether next frame begins a new numbering (first after connecting)
+    let goBack = ref false // whether to resend frames in flight (negatively acknowledged)
+    let acknowledged = new AutoResetEvent(false)
+    let sequenced (seq, execute, (code : byte array), synced) = // frame with header, flags, length, check and CRC
+        let flags = byte seq ||| if execute then 0x80uy else 0uy
+        let length = code.Length ||| if synced then 0x8000 else 0
+        let header = [|flags; byte (length >>> 8); byte length|]
+        let check = Array.fold crc16 0xFFFFus header
+        let crc = Array.fold crc16 check code
+        Array.concat [[|0uy|]; header; [|byte check|]; code; [|byte (crc >>> 8); byte crc|]]
+    let resend (port : SerialPort) = // frames in flight (from the oldest)
+        for frame in !inFlight do
+            let bytes = sequenced frame
+            port.Write(bytes, 0, bytes.Length)
+        port.BaseStream.Flush()
+    let resync () = // begin a new numbering with the oldest frame in flight (or the next sent)
+        match !inFlight with
+        | (s, e, c, _) :: t -> inFlight := (s, e, c, true) :: t; goBack := true
+        | [] -> sync := true
+    let acknowledge (ack : byte) = // drop frames acknowledged (cumulatively), noting when to go back
+        lock inFlight (fun () ->
+            let seq = int (ack &&& 0x7Fuy)
+            let index = !inFlight |> List.tryFindIndex (fun (s, _, _, _) -> s = seq)
+            match ack &&& 0x80uy, index with
+            | 0uy, Some i -> inFlight := List.skip (i + 1) !inFlight // up to and including seq
+            | 0uy, None -> () // stale (duplicate)
+            | _, Some i -> inFlight := List.skip i !inFlight; goBack := true // resend from expected
+            | _, None when seq = !sequence -> inFlight := [] // all taken (nak of frame following)
+            | _, None -> resync ()) // MCU out of sequence (e.g. reset)
+        acknowledged.Set() |> ignore
+    let rec awaitAcks port limit retries = // until no more than limit frames in flight
+        let pending, back = lock inFlight (fun () ->
+            let back = !goBack
+            if back then resend port
+            goBack := false
+            List.length !inFlight, back)
+        if pending > limit then
+            let retries = if back then retries + 1 else retries // resends without progress
+            if retries > 8 then failwith "MCU not acknowledging frames"
+            if acknowledged.WaitOne(!ackTimeout) then
+                let progress = lock inFlight (fun () -> List.length !inFlight < pending)
+                awaitAcks port limit (if progress then 0 else retries)
+            else
+                lock inFlight (fun () -> resend port) // timed out
+                awaitAcks port limit (retries + 1)
+    let profileOps = ref [] // opcode counts of profile being dumped
+    let profileWords = ref [] // word calls/times of profile being dumped
+    let byteAt (data : ArraySegment<byte>) i = data.Array.[data.Offset + i] // within event data (in batch chunk)
+    let decodeProfile (data : ArraySegment<byte>) = // accumulate profile chunk, true upon end of dump
+        let int16At i = (int (byteAt data i) <<< 8) ||| int (byteAt data (i + 1))
+        match byteAt data 0 with
+        | 0uy ->
+            for j in 1 .. 3 .. data.Count - 3 do
+                profileOps := (byteAt data j, int16At (j + 1)) :: !profileOps
+            false
+        | 1uy ->
+            for j in 1 .. 8 .. data.Count - 8 do
+                let time = (uint32 (int16At (j + 4)) <<< 16) ||| uint32 (int16At (j + 6))
+                profileWords := (int16At j, int16At (j + 2), time) :: !profileWords
+            false
+        | _ -> true
+    let traceRecords = ref [] // instruction records of trace being dumped (newest first)
+    let traceTimed = ref false
+    let decodeTrace (data : ArraySegment<byte>) = // accumulate trace chunk, true upon end of dump
+        let int16At i = (int (byteAt data i) <<< 8) ||| int (byteAt data (i + 1))
+        match byteAt data 0 with
+        | 0uy | 1uy as kind ->
+            let size = if kind = 1uy then 7 else 5
+            traceTimed := kind = 1uy
+            for j in 1 .. size .. data.Count - size do
+                let time = if kind = 1uy then int16At (j + 5) else 0
+                traceRecords := (int16At j, byteAt data (j + 2), int (int16 (int16At (j + 3))), time) :: !traceRecords
+            false
+        | _ -> true
+    let decodeTelemetry (data : ArraySegment<byte>) = // batched telemetry frame to (time, values) samples
+        let channels = int (byteAt data 0)
+        let i = ref 3
+        let varint () = // 7 bits per byte, least significant first
+            let rec varint' shift x =
+                let b = byteAt data !i
+                i := !i + 1
+                let x' = x ||| (int (b &&& 0x7Fuy) <<< shift)
+                if b &&& 0x80uy <> 0uy then varint' (shift + 7) x' else x'
+            varint' 0 0
+        let zigzag x = (x >>> 1) ^^^ -(x &&& 1) |> int16
+        let rec records time previous samples =
+            if !i >= data.Count then List.rev samples
+            else
+                let time' = (time + varint ()) &&& 0xFFFF
+                let values = Array.init channels (fun _ -> varint () |> zigzag)
+                let values' =
+                    match previous with
+                    | Some prev -> Array.map2 (+) prev values // deltas (wrapping)
+                    | None -> values // first record absolute
+                records time' (Some values') ((time', values') :: samples)
+        records ((int (byteAt data 1) <<< 8) ||| int (byteAt data 2)) None []
+    let describe (id : byte) (data : ArraySegment<byte>) = // event to eventFn (along with decoding, in place)
+        let event message = eventFn.Invoke(message)
+        let len = data.Count
+        let d = byteAt data
+        let toInt () =
+            match len with
+            | 0 -> 0
+            | 1 -> d 0 |> sbyte |> int
+            | 2 -> (int16 (d 0) <<< 8) ||| int16 (d 1) |> int
+            | 4 -> (int (d 0) <<< 24) ||| (int (d 1) <<< 16) ||| (int (d 2) <<< 8) ||| int (d 3) // 32-bit cells
+            | _ -> failwith "Invalid event data."
+        match id with
+        | id when id = 0xF0uy -> toInt () |> sprintf "%i" |> event
+        | 0xFFuy -> event "Boot event"
+        | 0xFDuy ->
+            for (time, values) in decodeTelemetry data do
+                sprintf "Telemetry (%ims): %s" time (String.Join(" ", values)) |> event
+        | 0xFBuy when len > 0 ->
+            if decodeProfile data then
+                (if compiler <> null then compiler.ProfileReport(!profileOps, !profileWords)
+                 else profileReport (newDictionary ()) !profileOps !profileWords) |> List.iter event
+                profileOps := []
+                profileWords := []
+        | 0xF8uy when len > 0 ->
+            if decodeTrace data then
+                let records = List.rev !traceRecords
+                (if compiler <> null then compiler.TraceReport(!traceTimed, records)
+                 else traceReport (newDictionary ()) 0 !traceTimed records) |> List.iter event
+                traceRecords := []
+        | 0xFCuy when len = 10 ->
+            let v i = (uint16 (d (i * 2)) <<< 8) ||| uint16 (d (i * 2 + 1))
+            sprintf "Loop stats (us): min %i max %i mean %i jitter %i overruns %i" (v 0) (v 1) (v 2) (v 3) (v 4) |> event
+        | 0xFAuy ->
+            (if len = 2 then sprintf "Saved image (tag %04x)" ((uint16 (d 0) <<< 8) ||| uint16 (d 1))
+             else "No saved image") |> event
+        | 0xFEuy ->
+            sprintf "VM Error: %s"
+                (match len, (if len = 1 then d 0 else 0uy) with
+                | 0, _ | 1, 0uy -> "Return stack underflow" // zero sent as no data
+                | 1, 1uy -> "Return stack overflow"
+                | 1, 2uy -> "Data stack underflow"
+                | 1, 3uy -> "Data stack overflow"
+                | 1, 4uy -> "Out of memory"
+                | 1, 5uy -> "Invalid code"
+                | 1, 6uy -> "Event overflow"
+                | _ -> "Unknown") |> event
+        | _ -> sprintf "Event (%i): %A" id (Array.init len d) |> event // unknown (rare), so copied for display
+    let chunkSize = 4096 // bytes read at once (and so per batch)
+    let pool = new ConcurrentBag<EventBatch>() // batches recycled
+    let batches = new BlockingCollection<EventBatch>(new ConcurrentQueue<EventBatch>(), 256) // queued for consumer
+    let mutable backlog = 0 // events queued and not yet taken
+    let mutable bytesRead = 0L
+    let mutable eventsParsed = 0L
+    let mutable batchesQueued = 0L
+    let mutable eventsDropped = 0L
+    let mutable parseTicks = 0L // Stopwatch ticks spent parsing
+    let mutable (readFault : string option) = None // I/O error that stopped the reader
+    let rent () =
+        match pool.TryTake() with
+        | true, batch -> batch.Clear(); batch
+        | _ -> new EventBatch(chunkSize)
+    let recycle (batch : EventBatch) = if pool.Count < 64 then pool.Add(batch)
+    let deliver (batch : EventBatch) = // to consumer, unless fallen behind
+        Interlocked.Add(&backlog, batch.Count) |> ignore
+        if batches.TryAdd(batch) then batchesQueued <- batchesQueued + 1L
+        else
+            Interlocked.Add(&backlog, -batch.Count) |> ignore
+            eventsDropped <- eventsDropped + int64 batch.Count
+            recycle batch
+    let take (batch : EventBatch) = Interlocked.Add(&backlog, -batch.Count) |> ignore; batch
+    let readEvents (port : SerialPort) () = // chunks into batches, parsed in place (until port closed)
+        let mutable batch = rent ()
+        let mutable filled = 0
+        try
+            while port.IsOpen do
+                let n = try port.Read(batch.Buffer, filled, chunkSize - filled) with :? TimeoutException -> 0
+                if n > 0 then
+                    let start = Stopwatch.GetTimestamp()
+                    let buffer = batch.Buffer
+                    filled <- filled + n
+                    let mutable i = 0 // start of next event
+                    while i + 2 <= filled && i + 2 + int buffer.[i] <= filled do
+                        let len, id = int buffer.[i], buffer.[i + 1]
+                        if id = 0xF9uy && len = 1 then acknowledge buffer.[i + 2] // link event (not delivered)
+                        else
+                            if id = 0xFFuy then lock inFlight resync // MCU numbering begins anew
+                            if id = 0xFAuy then
+                                imageTag := if len = 2 then Some ((uint16 buffer.[i + 2] <<< 8) ||| uint16 buffer.[i + 3]) else None
+                                imageReported.Set() |> ignore
+                            batch.Add(i)
+                        i <- i + 2 + len
+                    let partial = filled - i // bytes of incomplete event
+                    if batch.Count > 0 then
+                        let next = rent ()
+                        Buffer.BlockCopy(buffer, i, next.Buffer, 0, partial)
+                        eventsParsed <- eventsParsed + int64 batch.Count
+                        deliver batch
+                        batch <- next
+                    elif i > 0 then Buffer.BlockCopy(buffer, i, buffer, 0, partial)
+                    filled <- partial
+                    bytesRead <- bytesRead + int64 n
+                    parseTicks <- parseTicks + Stopwatch.GetTimestamp() - start
+        with
+        | _ when not port.IsOpen -> () // closed while reading
+        | e -> // device gone, driver error, ... (reader stopped, port left for Disconnect)
+            readFault <- Some e.Message
+            if eventFn <> null then sprintf "Reader stopped: %s" e.Message |> eventFn.Invoke
+        recycle batch
+    let describeEvents () = // batches taken and described to eventFn (off the read thread, until null queued)
+        let mutable more = true
+        while more do
+            match batches.Take() with
+            | null -> more <- false // disconnected
+            | batch ->
+                let batch = take batch
+                for i in 0 .. batch.Count - 1 do
+                    describe (batch.Id(i)) (batch.Data(i)) // slice of pooled chunk (valid until recycled)
+                recycle batch
     let mutable (readThread: Thread) = null
-    member x.Connect(com) =
-        let port = new SerialPort(com, 19200)
+    let mutable (describeThread: Thread) = null // per connection, given an eventFn
+    new(eventFn, traceFn) = new Communication(eventFn, traceFn, null) // profile and trace reports unnamed
+    member x.Connect(com) = x.Connect(com, 19200) // default speed (DEFAULT_BAUD in firmware)
+    member x.Connect(com, baud : int) =
+        let port = new SerialPort(com, baud)
         serial := Some port
+        port.ReadTimeout <- 100 // milliseconds (read thread noticing the port closed)
         port.Open()
         port.DiscardInBuffer()
         port.DiscardOutBuffer()
-        readThread <- new Thread(readEvents, IsBackground = true)
+        lock inFlight (fun () -> inFlight := []; sync := true)
+        readFault <- None
+        readThread <- new Thread(readEvents port, IsBackground = true)
         readThread.Start()
+        if eventFn <> null then
+            describeThread <- new Thread(describeEvents, IsBackground = true)
+            describeThread.Start()
     member x.Disconnect() =
         match !serial with
         | Some port ->
             port.Close()
             serial := None
-            readThread.Abort()
+            readThread.Join() // upon noticing the port closed
             readThread <- null
+            if describeThread <> null then
+                batches.Add(null) // after those queued (described first)
+                describeThread.Join()
+                describeThread <- null
         | None -> failwith "Not connected"
     member x.SendBytes(execute, bytecode) =
         let trace () = if traceFn <> null then traceFn.Invoke(execute, bytecode)
-        match !serial with
-        | Some port ->
+        match !captured, !serial with
+        | Some frames, _ -> captured := Some ((execute, bytecode) :: frames)
+        | None, Some port when !window > 0 ->
+            trace ()
+            awaitAcks port (!window - 1) 0 // room in window
+            lock inFlight (fun () ->
+                let frame = !sequence, execute, bytecode, !sync
+                sequence := (!sequence + 1) &&& 0x7F
+                sync := false
+                inFlight := !inFlight @ [frame]
+                let bytes = sequenced frame
+                port.Write(bytes, 0, bytes.Length)
+                port.BaseStream.Flush())
+        | None, Some port ->
             if bytecode.Length > 127 then failwith "Too much bytecode in single packet"
             trace ()
             let header = (byte bytecode.Length ||| if execute then 0x80uy else 0uy)
             port.Write(Array.create 1 header, 0, 1)
             port.Write(bytecode, 0, bytecode.Length)
             port.BaseStream.Flush()
-        | None -> failwith "Not connected to MCU."
\ No newline at end of file
+        | None, None -> failwith "Not connected to MCU."
+    member x.Window // sequenced frames kept in flight (0 for plain frames, the default)
+        with get () = !window
+        and set (w : int) =
+            if w <= 0 && !window > 0 then
+                x.Flush()
+                Thread.Sleep(150) // line quiet (FRAME_TIMEOUT) for the MCU to take plain frames again
+            window := max 0 (min 32 w) // well within half the sequence space
+    member x.AckTimeout with get () = !ackTimeout and set (ms : int) = ackTimeout := ms
+    member x.TakeEvents(timeout : int) = // next batch of events (null if none within timeout ms)
+        let mutable batch = null
+        if batches.TryTake(&batch, timeout) then take batch else null
+    member x.Recycle(batch : EventBatch) = recycle batch // batch taken and done with
+    member x.ReaderStats =
+        { Bytes = bytesRead
+          Events = eventsParsed
+          Batches = batchesQueued
+          Dropped = eventsDropped
+          Backlog = backlog
+          BacklogBatches = batches.Count
+          ParseSeconds = float parseTicks / float Stopwatch.Frequency
+          Fault = readFault }
+    member x.Flush() = // await acknowledgement of all frames in flight
+        match !serial with
+        | Some port -> awaitAcks port 0 0
+        | None -> ()
+    member x.Capture(fn : Action) = // frames sent by fn (in order) captured rather than sent
+        captured := Some []
+        try
+            fn.Invoke()
+            !captured |> Option.get |> List.rev
+        finally captured := None
+    static member Tag(frames : (bool * byte array) list) = // CRC-16/CCITT of frames (headers and code)
+        frames |> List.fold (fun crc (execute, code) ->
+            let header = byte (Array.length code) ||| if execute then 0x80uy else 0uy
+            Array.fold crc16 (crc16 crc header) code) 0xFFFFus
+    member x.QueryImage(imageTagCode : byte array, timeout : int) = // tag of image saved at MCU (if any)
+        imageReported.Reset() |> ignore
+        imageTag := None
+        x.SendBytes(true, imageTagCode)
+        if imageReported.WaitOne(timeout) then !imageTag else None
+
+(* A group of boards running the same firmware (the same bind table) and kept in the same state share
+   a single Compiler; code is compiled and reified once, each definition landing at the same address
+   on every board. Frames are captured once (Capture, as with Communication) and uploaded to every
+   board at once, each over a Communication of its own on a thread of its own; so provisioning takes
+   about as long for many boards as for one. Progress (frames sent of the total) is reported per board
+   to progressFn and events to eventFn, along with the board's port.
+
+   The frames uploaded since the last Reset are kept, so that a board added later (or again) is reset
+   and brought up to the group's state by replaying them (immediate code included). A board failing
+   part way is no longer in the same state as the others; it is disconnected and dropped from the
+   group, and reported (along with the exception) by Add or Upload. Boards with other firmware need
+   a group of their own. *)
+
+type BoardGroup(compiler : Compiler, eventFn : Action<string, string>, progressFn : Action<string, int, int>) =
+    let boards = new ResizeArray<string * Communication>() // port and connection of boards in step
+    let history = new ResizeArray<bool * byte array>() // frames uploaded since reset
+    let (captured : (bool * byte array) list option ref) = ref None // frames captured rather than sent
+    let window = ref 0
+    let resetFrame () = true, compiler.EagerCompile("(reset)") |> fst
+    let fanOut (work : string -> unit) ports = // work for each port in parallel, giving failures
+        let failures = new ConcurrentBag<string * exn>()
+        let threads =
+            ports |> List.map (fun port ->
+                new Thread((fun () -> try work port with ex -> failures.Add((port, ex))), IsBackground = true))
+        List.iter (fun (t : Thread) -> t.Start()) threads
+        List.iter (fun (t : Thread) -> t.Join()) threads
+        List.ofSeq failures
+    let send port (comm : Communication) frames = // frames to a board, then awaiting acknowledgement
+        let total = List.length frames
+        frames |> List.iteri (fun i frame ->
+            comm.SendBytes frame
+            if progressFn <> null then progressFn.Invoke(port, i + 1, total))
+        comm.Flush()
+    let drop port = // fallen out of step
+        let i = lock boards (fun () -> boards.FindIndex(fun (p, _) -> p = port))
+        if i >= 0 then
+            let _, comm = boards.[i]
+            lock boards (fun () -> boards.RemoveAt(i))
+            try comm.Disconnect() with _ -> ()
+    let upload frames = // to every board in the group
+        history.AddRange(frames)
+        let ports = lock boards (fun () -> boards |> List.ofSeq)
+        let failures = fanOut (fun port -> send port (ports |> List.find (fst >> (=) port) |> snd) frames) (List.map fst ports)
+        failures |> List.iter (fst >> drop)
+        failures
+    new(compiler) = new BoardGroup(compiler, null, null)
+    member x.Compiler = compiler
+    member x.Ports = lock boards (fun () -> boards |> Seq.map fst |> List.ofSeq)
+    member x.Board(port) = lock boards (fun () -> boards |> Seq.find (fst >> (=) port) |> snd)
+    member x.Add(ports : string seq) = x.Add(ports, 19200) // default speed (DEFAULT_BAUD in firmware)
+    member x.Add(ports : string seq, baud : int) = // connect, reset and bring up to the group's state; giving failures
+        let frames = resetFrame () :: List.ofSeq history
+        ports |> List.ofSeq |> fanOut (fun port ->
+            let events = if eventFn <> null then Action<string>(fun e -> eventFn.Invoke(port, e)) else null
+            let comm = new Communication(events, null, compiler)
+            comm.Connect(port, baud)
+            try
+                comm.Window <- !window
+                send port comm frames
+            with _ -> (try comm.Disconnect() with _ -> ()); reraise ()
+            lock boards (fun () -> boards.Add((port, comm))))
+    member x.SendBytes(execute, bytecode) =
+        match !captured with
+        | Some frames -> captured := Some ((execute, bytecode) :: frames)
+        | None -> upload [execute, bytecode] |> ignore
+    member x.Capture(fn : Action) = // frames sent (to the group) by fn, in order, captured rather than sent
+        captured := Some []
+        try
+            fn.Invoke()
+            !captured |> Option.get |> List.rev
+        finally captured := None
+    member x.Upload(frames : (bool * byte array) list) = upload frames // to every board at once; giving failures
+    member x.Provision(fn : Action) = x.Capture(fn) |> upload // frames sent by fn compiled once, uploaded to all
+    member x.Reset() = // boards and compiler, forgetting frames uploaded
+        compiler.Reset()
+        history.Clear()
+        let failures = upload [resetFrame ()]
+        history.Clear()
+        failures
+    member x.Window // sequenced frames kept in flight per board (see Communication)
+        with get () = !window
+        and set (w : int) =
+            window := w
+            lock boards (fun () -> boards |> List.ofSeq) |> List.iter (fun (_, comm) -> comm.Window <- w)
+    member x.Disconnect() =
+        let ports = lock boards (fun () -> let p = List.ofSeq boards in boards.Clear(); p)
+        ports |> List.iter (fun (_, comm) -> comm.Disconnect())
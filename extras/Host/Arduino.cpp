@@ -0,0 +1,119 @@
+/* Arduino.cpp (host)
+
+Host implementations of the Arduino core stand-ins declared in Arduino.h and Wire.h. */
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <EEPROM.h>
+#include <chrono>
+#include <thread>
+
+HardwareSerial Serial;
+TwoWire Wire;
+EEPROMClass EEPROM;
+
+int hostDigital[HOST_PINS];
+int hostAnalog[HOST_PINS];
+unsigned long hostPulse = 0;
+volatile uint8_t hostPortOutput[HOST_PINS / 8];
+volatile uint8_t hostPortInput[HOST_PINS / 8];
+
+static void (*hostISRs[HOST_INTERRUPTS])();
+
+static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+unsigned long millis()
+{
+    return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+unsigned long micros()
+{
+    return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+void delay(unsigned long ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    (void)pin;
+    (void)mode;
+}
+
+int digitalRead(uint8_t pin)
+{
+    return pin < HOST_PINS ? hostDigital[pin] : LOW;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    if (pin < HOST_PINS) hostDigital[pin] = value;
+}
+
+int analogRead(uint8_t pin)
+{
+    return pin < HOST_PINS ? hostAnalog[pin] : 0;
+}
+
+void analogWrite(uint8_t pin, int value)
+{
+    if (pin < HOST_PINS) hostAnalog[pin] = value;
+}
+
+unsigned long pulseIn(uint8_t pin, uint8_t state)
+{
+    (void)pin;
+    (void)state;
+    return hostPulse;
+}
+
+void attachInterrupt(uint8_t interrupt, void (*isr)(), int mode)
+{
+    (void)mode;
+    if (interrupt < HOST_INTERRUPTS) hostISRs[interrupt] = isr;
+}
+
+void detachInterrupt(uint8_t interrupt)
+{
+    if (interrupt < HOST_INTERRUPTS) hostISRs[interrupt] = 0;
+}
+
+void hostInterrupt(uint8_t interrupt)
+{
+    if (interrupt < HOST_INTERRUPTS && hostISRs[interrupt] != 0) hostISRs[interrupt]();
+}
+
+int HardwareSerial::read()
+{
+    if (in.empty()) return -1;
+    uint8_t b = in.front();
+    in.pop_front();
+    return b;
+}
+
+size_t HardwareSerial::write(uint8_t b)
+{
+    if (txRoom == 0) return 0; // no room
+    if (txRoom > 0) txRoom--;
+    writtenCount++;
+    if (!discarding) out.push_back(b);
+    return 1;
+}
+
+int TwoWire::read()
+{
+    if (in.empty()) return -1;
+    uint8_t b = in.front();
+    in.pop_front();
+    return b;
+}
@@ -0,0 +1,147 @@
+/* Arduino.h (host)
+
+Just enough of the Arduino core for Brief.cpp to build and run natively on a PC; for benchmarking
+and experimenting without flashing a board. Time is real (steady clock). GPIO, analog and interrupt
+state is kept in arrays that the host program may poke. `Serial` is scriptable: input is queued by
+the host program and output collected for inspection. */
+
+#ifndef ARDUINO_HOST_H
+#define ARDUINO_HOST_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH         1
+#define LOW          0
+
+#define INPUT        0
+#define OUTPUT       1
+#define INPUT_PULLUP 2
+
+#define CHANGE       1
+#define FALLING      2
+#define RISING       3
+
+#define PROGMEM
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#define pgm_read_word(address) (*(const uint16_t*)(address))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+int analogRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+unsigned long pulseIn(uint8_t pin, uint8_t state);
+
+void attachInterrupt(uint8_t interrupt, void (*isr)(), int mode);
+void detachInterrupt(uint8_t interrupt);
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+/* The following are host-only; allowing a host program to stand in for the hardware. */
+
+#define HOST_PINS       64 // simulated digital/analog pins
+#define HOST_INTERRUPTS 8  // simulated external interrupts
+
+extern int hostDigital[HOST_PINS]; // digital pin levels (read by digitalRead, written by digitalWrite)
+extern int hostAnalog[HOST_PINS]; // analog pin values (read by analogRead, written by analogWrite)
+extern unsigned long hostPulse; // value given by pulseIn
+
+void hostInterrupt(uint8_t interrupt); // fire attached interrupt routine (if any)
+
+/* Simulated ports of eight pins each, for direct port access. These are registers of their own; not
+tied to the pin levels above (digitalWrite doesn't change them, nor port writes digitalRead). */
+
+#define NUM_DIGITAL_PINS HOST_PINS
+#define PORT_IO 8
+#define PORT_LOCK()
+#define PORT_UNLOCK()
+#define digitalPinToPort(pin)    ((pin) / 8)
+#define digitalPinToBitMask(pin) ((uint8_t)(1 << ((pin) % 8)))
+#define portOutputRegister(port) (&hostPortOutput[port])
+#define portInputRegister(port)  (&hostPortInput[port])
+
+extern volatile uint8_t hostPortOutput[HOST_PINS / 8]; // port output registers
+extern volatile uint8_t hostPortInput[HOST_PINS / 8]; // port input registers (poked by host program)
+
+#define PERSIST 1 // EEPROM stand-in (see EEPROM.h)
+
+class Stream
+{
+public:
+    virtual ~Stream() {}
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual size_t write(uint8_t b) = 0;
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+
+    size_t write(const uint8_t* buffer, size_t length)
+    {
+        size_t n = 0;
+        while (n < length && write(buffer[n])) n++;
+        return n;
+    }
+
+    size_t readBytes(char* buffer, size_t length) // without timeout (bytes available only)
+    {
+        size_t n = 0;
+        while (n < length && available() > 0) buffer[n++] = read();
+        return n;
+    }
+
+    size_t readBytes(uint8_t* buffer, size_t length)
+    {
+        return readBytes((char*)buffer, length);
+    }
+};
+
+/* The scriptable serial port. Bytes given to `input` are read by the VM as if received from the PC.
+Bytes written by the VM are collected (unless `discard` is set) for `output`. Transmit room reported by
+`availableForWrite` may be limited to simulate a slow link; each byte written using up room and
+`room` replenishing it. */
+
+class HardwareSerial : public Stream
+{
+public:
+    void begin(unsigned long baud) { (void)baud; }
+    void end() {}
+
+    int available() { return (int)in.size(); }
+    int read();
+    int peek() { return in.empty() ? -1 : in.front(); }
+    size_t write(uint8_t b);
+    int availableForWrite() { return txRoom < 0 || txRoom > 0x7FFF ? 0x7FFF : (int)txRoom; }
+    using Stream::write;
+
+    void input(const uint8_t* data, size_t length) { in.insert(in.end(), data, data + length); }
+    void input(uint8_t b) { in.push_back(b); }
+    const std::vector<uint8_t>& output() const { return out; }
+    void clearOutput() { out.clear(); }
+    void room(long bytes) { txRoom = bytes; } // transmit room (-1 for unlimited, the default)
+    void discard(bool d) { discarding = d; } // drop output rather than collecting it
+    unsigned long written() const { return writtenCount; } // total bytes written
+
+private:
+    std::deque<uint8_t> in;
+    std::vector<uint8_t> out;
+    long txRoom = -1;
+    bool discarding = false;
+    unsigned long writtenCount = 0;
+};
+
+extern HardwareSerial Serial;
+
+#endif // ARDUINO_HOST_H
@@ -0,0 +1,193 @@
+/* Benchmark.cpp (host)
+
+Micro-benchmarks of the Brief VM built natively against the host Arduino stand-in. Each benchmark is
+a definition sent down over the (scriptable) serial port exactly as from the PC, wrapped in a counted
+`next` loop and executed repeatedly for a given duration (default 250ms, or first argument). Reported
+are nanoseconds per VM instruction and instructions per second. An instruction is a single dispatch:
+a primitive (ret included) or a call.
+
+Any output from the VM during a (non-event) benchmark indicates an error (e.g. stack overflow) and
+is reported.
+
+Built with VERIFY and an inline engine, a few checks of the verifier run first; failing with a
+non-zero exit status (the `ctest` case of the host build). */
+
+#include <Brief.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <vector>
+
+#define LOOP_COUNT 1000 // iterations of benchmark body per execution
+
+static int16_t here = 0; // mirror of dictionary pointer (definitions are appended in order)
+
+static void send(bool exec, const std::vector<uint8_t>& code) // frame code and run until consumed
+{
+    Serial.input((exec ? 0x80 : 0) | code.size());
+    Serial.input(code.data(), code.size());
+    while (Serial.available() > 0) brief::loop();
+    brief::loop(); // complete final frame
+}
+
+static int16_t define(const std::vector<uint8_t>& code) // send definition, giving its address
+{
+    int16_t address = here;
+    send(false, code);
+    here += code.size();
+    return address;
+}
+
+static std::vector<uint8_t> call(int16_t address) // call instruction to given address
+{
+    return { (uint8_t)(0x80 | (address >> 8)), (uint8_t)address };
+}
+
+static std::vector<uint8_t> operator+(std::vector<uint8_t> a, const std::vector<uint8_t>& b)
+{
+    a.insert(a.end(), b.begin(), b.end());
+    return a;
+}
+
+static std::vector<uint8_t> repeat(const std::vector<uint8_t>& body) // wrap body in counted loop
+{
+    return std::vector<uint8_t> { 2, LOOP_COUNT >> 8, LOOP_COUNT & 0xFF, 38 } // lit16 count, push
+        + body
+        + std::vector<uint8_t> { 58, (uint8_t)body.size(), 0 }; // next, ret
+}
+
+static double duration = 0.25; // seconds per benchmark
+
+#if VERIFY && DISPATCH != DISPATCH_TABLE
+static bool raised() // whether VM output holds an error event
+{
+    const std::vector<uint8_t>& out = Serial.output();
+    for (size_t i = 0; i + 1 < out.size(); i += 2 + (out[i] & 0x7F)) // length, id, data
+    {
+        if (out[i + 1] == 0xFE) return true;
+    }
+    return false;
+}
+
+static bool check(const char* name, bool ok)
+{
+    printf("%-28s %s\n", name, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+static bool checks() // of the verifier (with the unchecked engine in use)
+{
+    bool ok = true;
+
+    // pushed return: `lit16 X push ret` returns into X (`+`, run on an empty stack); must run checked
+    int16_t target = define({ 13, 0 });
+    int16_t word = define({ 2, (uint8_t)(target >> 8), (uint8_t)target, 38, 0 });
+    send(true, { 37 }); // clr
+    Serial.clearOutput();
+    ok &= check("pushed return not bounded", !brief::vm.bounded(word));
+    brief::exec(word);
+    brief::loop(); // drain events
+    ok &= check("pushed return runs checked", raised());
+    Serial.clearOutput();
+
+    // pushed tail call: `lit16 Y push Y` (tail call to `+ drop`, Y returning into Y); likewise
+    target = define({ 13, 32, 0 });
+    word = define({ 2, (uint8_t)(target >> 8), (uint8_t)target, 38, (uint8_t)(0x80 | (target >> 8)), (uint8_t)target, 0 });
+    send(true, { 37, 1, 1, 1, 2 }); // clr 1 2 (for the call, then underflowing upon return into Y)
+    Serial.clearOutput();
+    ok &= check("pushed call not bounded", !brief::vm.bounded(word));
+    brief::exec(word);
+    brief::loop(); // drain events
+    ok &= check("pushed call runs checked", raised());
+    Serial.clearOutput();
+
+    send(true, { 48 }); // reset
+    here = 0;
+    Serial.clearOutput();
+    printf("\n");
+    return ok;
+}
+#endif
+
+static void bench(const char* name, int16_t seed, const std::vector<uint8_t>& body, int perIteration,
+    bool events = false)
+{
+    send(true, { 37, 2, (uint8_t)(seed >> 8), (uint8_t)seed }); // clr, seed stack
+    int16_t word = define(repeat(body));
+    long perExec = 3 + (long)LOOP_COUNT * (perIteration + 1); // lit16, push, ret + body and next
+
+    Serial.clearOutput();
+    Serial.discard(events);
+    unsigned long execs = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now(), now;
+    do
+    {
+        for (int i = 0; i < 16; i++) brief::exec(word);
+        execs += 16;
+        now = std::chrono::steady_clock::now();
+    } while (std::chrono::duration<double>(now - start).count() < duration);
+    Serial.discard(false);
+
+    double ns = std::chrono::duration<double, std::nano>(now - start).count() / ((double)execs * perExec);
+    printf("%-28s %8.2f %12.1fM\n", name, ns, 1000.0 / ns);
+    if (!Serial.output().empty())
+    {
+        printf("  unexpected VM output:");
+        for (size_t i = 0; i < Serial.output().size() && i < 16; i++) printf(" %02x", Serial.output()[i]);
+        printf("\n");
+        Serial.clearOutput();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1) duration = atof(argv[1]) / 1000.0;
+
+    brief::setup();
+    send(true, { 48 }); // reset
+    Serial.clearOutput();
+
+    printf("Brief VM benchmarks (DISPATCH %i, TOS_CACHE %i, VERIFY %i, PROFILE %i, BUDGET %i, TRACE %i)\n\n",
+        DISPATCH, TOS_CACHE, VERIFY, PROFILE, BUDGET, TRACE);
+#if VERIFY && DISPATCH != DISPATCH_TABLE
+    if (!checks()) return 1;
+#endif
+    printf("%-28s %8s %13s\n", "benchmark", "ns/op", "instr/sec");
+
+    // dispatch-heavy: nop nop nop nop nop nop nop nop
+    bench("dispatch (nop)", 0, { 59, 59, 59, 59, 59, 59, 59, 59 }, 8);
+
+    // arithmetic kernel: dup 3 * + 7 and dup 5 xor - 1+
+    bench("arithmetic", 1, { 33, 1, 3, 15, 13, 1, 7, 18, 33, 1, 5, 20, 14, 30 }, 11);
+
+    // superinstructions: dup (dup *) (swap -) (0 =) (1 +) (0 @) + (2 digitalRead) -
+    bench("superinstructions", 3, { 33, 62, 64, 65, 60, 1, 61, 0, 13, 63, 2, 14 }, 9);
+
+    // deep calls: d0 = nop ; dN = dN-1 nop (5 deep, not tail calls)
+    int16_t deep = define({ 59, 0 });
+    for (int i = 0; i < 5; i++) deep = define(call(deep) + std::vector<uint8_t> { 59, 0 });
+    bench("deep calls", 0, call(deep), 1 + 5 * 3 + 2);
+
+    // tail calls: t0 = nop ; tN = nop tN-1 (15 deep, tail calls)
+    int16_t tail = define({ 59, 0 });
+    for (int i = 0; i < 15; i++) tail = define(std::vector<uint8_t> { 59 } + call(tail) + std::vector<uint8_t> { 0 });
+    bench("tail calls", 0, call(tail), 1 + 15 * 2 + 2);
+
+    // fixed point: dup 3 q8* +sat -100 100 clamp
+    bench("fixed point", 50, { 33, 1, 3, 70, 72, 1, 0x9C, 1, 100, 74 }, 7);
+
+    // port I/O: 0 pinToggle (handle 0 resolved beforehand by 13 pinHandle drop)
+    send(true, { 1, 13, 75, 32 });
+    bench("pin toggle", 0, { 1, 0, 78 }, 2);
+
+    // quotations: dup 1 and [1+] [1-] choice
+    bench("quotation choice", 0, { 33, 1, 1, 18, 3, 2, 30, 0, 3, 2, 31, 0, 43 }, 8);
+
+    // lowered conditional: dup 1 and (zbranch 3) 1+ (branch 2) 1- nop
+    bench("branches", 0, { 33, 1, 1, 18, 66, 3, 30, 67, 2, 31, 59 }, 6);
+
+    // events: dup 7 event (two byte value)
+    bench("events", 1000, { 33, 1, 7, 8 }, 3, true);
+
+    return 0;
+}
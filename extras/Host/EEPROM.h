@@ -0,0 +1,28 @@
+/* EEPROM.h (host)
+
+EEPROM stand-in for host builds of Brief. Contents are kept in memory (erased to 0xFF) for the life
+of the host program; enough to save and restore dictionary images. */
+
+#ifndef EEPROM_HOST_H
+#define EEPROM_HOST_H
+
+#include <Arduino.h>
+
+#define HOST_EEPROM_SIZE 4096 // simulated EEPROM bytes
+
+class EEPROMClass
+{
+public:
+    EEPROMClass() { memset(bytes, 0xFF, sizeof(bytes)); }
+    uint8_t read(int address) { return address >= 0 && address < HOST_EEPROM_SIZE ? bytes[address] : 0xFF; }
+    void write(int address, uint8_t value) { if (address >= 0 && address < HOST_EEPROM_SIZE) bytes[address] = value; }
+    void update(int address, uint8_t value) { write(address, value); }
+    uint16_t length() { return HOST_EEPROM_SIZE; }
+
+private:
+    uint8_t bytes[HOST_EEPROM_SIZE];
+};
+
+extern EEPROMClass EEPROM;
+
+#endif // EEPROM_HOST_H
@@ -0,0 +1,35 @@
+/* Wire.h (host)
+
+Minimal I2C (Wire) stand-in for host builds of Brief. Bytes given to `input` are read as if
+received from a device; bytes written are collected for `output`. */
+
+#ifndef WIRE_HOST_H
+#define WIRE_HOST_H
+
+#include <Arduino.h>
+
+class TwoWire
+{
+public:
+    void begin() {}
+    uint8_t requestFrom(int address, int count) { (void)address; return count < (int)in.size() ? count : (uint8_t)in.size(); }
+    int available() { return (int)in.size(); }
+    int read();
+    void beginTransmission(uint8_t address) { (void)address; }
+    size_t write(uint8_t b) { out.push_back(b); return 1; }
+    uint8_t endTransmission(bool stop = true) { (void)stop; return 0; }
+    template <typename Handler> void onReceive(Handler handler) { (void)handler; }
+    void onRequest(void (*handler)()) { (void)handler; }
+
+    void input(const uint8_t* data, size_t length) { in.insert(in.end(), data, data + length); }
+    const std::vector<uint8_t>& output() const { return out; }
+    void clearOutput() { out.clear(); }
+
+private:
+    std::deque<uint8_t> in;
+    std::vector<uint8_t> out;
+};
+
+extern TwoWire Wire;
+
+#endif // WIRE_HOST_H
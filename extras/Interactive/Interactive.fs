@@ -25,7 +25,8 @@ let comm =
                     (if execute then "Execute" else "Define")
                     (compiler.Disassemble(bytecode))
                     bytecode.Length
-                    (new String(bytecode |> Array.map (sprintf "%02x ") |> Seq.concat |> Array.ofSeq))))
+                    (new String(bytecode |> Array.map (sprintf "%02x ") |> Seq.concat |> Array.ofSeq))),
+        compiler)
 
 (* Here we use the lexer/parser to process lines of Brief code. Most everything is handled by the
    compiler, but several words are intercepted here as "compile-time" words for the interactive:
@@ -34,10 +35,13 @@ let comm =
    to an MCU before executing anything or issuing definitions. The 'connect' word expects a
    quotation (on the compiler-stack) containing a single word specifying the COM port. This sounds
    strange to use undefined words such as "com16", but remember that this is consumed by the
-   interactive at compile-time. There need not be any such words in the dictionary. Examples:
+   interactive at compile-time. There need not be any such words in the dictionary. The port speed
+   defaults to 19200 baud (matching `brief::setup()` in the firmware) but may be given before the
+   port (e.g. for firmware set up with `brief::setup(Serial1, 115200)`). Examples:
 
        'com16 connect
        'com8 conn
+       115200 'com8 connect
 
        disconnect
 
@@ -83,6 +87,28 @@ let comm =
         'foo.txt load
         'c:\temp\test.txt load
 
+    A library may instead be loaded as an image, saved in EEPROM at the MCU (firmware with PERSIST).
+    The file is compiled without sending anything and the resulting frames are tagged by hash. If the
+    MCU reports having saved an image of the same tag then it is simply restored there (and only the
+    immediate code in the file is sent). Otherwise the MCU is reset, the frames are uploaded and the
+    image is saved. Either way the compiler ends up as it would be having loaded the file:
+
+        'stdlib.b image
+
+    Stable library words may be baked into the firmware, executed in place from flash (firmware with
+    ROM), rather than uploaded at all. The given words (and any they depend upon) are compiled to an
+    image at the flash region and written out as a C header to be built into the firmware. The MCU
+    and compiler are reset, after which the words are known to be in flash. Baking the same words
+    again in a later session (without flashing) gives the same addresses:
+
+        [clamp sign tri] 'BriefROM.h rom
+
+    Uploads are normally sent blind. Firmware with ACKED_FRAMES may be sent sequenced frames instead;
+    each checked and acknowledged by the MCU, with up to the given number in flight and any lost
+    resent (0 returning to plain frames):
+
+        8 window
+
     Commented lines may begin with backslash (\).
 
     Debugging mode may be toggled in which disassembly and raw bytecode are displayed. For example,
@@ -137,22 +163,67 @@ let comm =
 
     We can clearly see that only the 2-byte calls need to be send as the definitions are already in
     the dictionary at the MCU. All of these interesting mechanics and the raw and disassembled
-    bytecode can be seen with tracing on. *)
+    bytecode can be seen with tracing on.
+
+    Common instruction sequences (e.g. "dup *" or "1 +") are fused into single superinstructions
+    as code is compiled. The fusions word reports how many times each sequence has been fused:
+
+        > fusions
+          dup *: 2
+          lit8 +: 5
+
+    The most used constants (0, 1, 2 and -1) are single-byte instructions. The most called words
+    may be made single-byte calls too, by binding them to call vectors (eight at most, firmware
+    CALL_VECTORS). The calls word reports how many calls to each word have been compiled (most
+    first) and vectors binds the given words; code compiled from then on calling through them:
+
+        > calls
+          min: 12
+          abs: 7
+        > [min abs] vectors
+
+    With firmware built for profiling (PROFILE), dumpProfile reports opcode executions along with
+    calls and time per word; named through the dictionary:
+
+        > dumpProfile
+
+    With firmware built for tracing (TRACE), dumpTrace reports the call tree rebuilt from the last
+    instructions executed, with calls and inclusive/exclusive time per word (resetTrace beginning
+    anew):
+
+        > resetTrace foo dumpTrace *)
 
 let rec rep line =
     let reset () = comm.SendBytes(true, compiler.EagerCompile("(reset)") |> fst)
+    let exec code = comm.SendBytes(true, Array.append code [|0uy|])
+    let load path =
+        use file = File.OpenText path
+        file.ReadToEnd().Split '\n'
+        |> Array.iter (fun line ->
+            printfn "  %s" line
+            rep line)
     let p = line |> parse
     let rec rep' stack = function
         | Token tok :: t ->
             match tok with
             | "connect" | "conn" ->
                 match stack with
+                | [Quotation [Token com]] :: [Token baud] :: stack' when fst (Int32.TryParse baud) ->
+                    printfn "Connecting to %s at %s baud" com baud
+                    comm.Connect(com, Int32.Parse baud)
+                    reset ()
+                    rep' stack' t
+                | [Quotation [Token com]] :: [Number baud] :: stack' ->
+                    printfn "Connecting to %s at %i baud" com baud
+                    comm.Connect(com, int baud)
+                    reset ()
+                    rep' stack' t
                 | [Quotation [Token com]] :: stack' ->
                     printfn "Connecting to %s" com
                     comm.Connect(com)
                     reset ()
                     rep' stack' t
-                | _ -> failwith "Malformed connect syntax - usage: '7 connect"
+                | _ -> failwith "Malformed connect syntax - usage: 'com7 connect or 115200 'com7 connect"
             | "disconnect" ->
                 comm.Disconnect()
                 rep' stack t
@@ -181,13 +252,45 @@ let rec rep line =
             | "load" ->
                 match stack with
                 | [Quotation [Token path]] :: stack' ->
-                    use file = File.OpenText path
-                    file.ReadToEnd().Split '\n'
-                    |> Array.iter (fun line ->
-                        printfn "  %s" line
-                        rep line)
+                    load path
                     rep' stack' t
                 | _ -> failwith "Malformed load syntax - usage: 'foo.txt load"
+            | "image" ->
+                match stack with
+                | [Quotation [Token path]] :: stack' ->
+                    compiler.Reset()
+                    let frames = comm.Capture(fun () -> load path)
+                    let tag = Communication.Tag frames
+                    let query = Array.append (compiler.EagerCompile("imageTag") |> fst) [|0uy|]
+                    match comm.QueryImage(query, 2000) with
+                    | Some saved when saved = tag ->
+                        printfn "Image %04x already saved at MCU (restoring rather than uploading)" tag
+                        compiler.EagerCompile("restore") |> fst |> exec
+                        frames |> List.filter fst |> List.iter comm.SendBytes // immediate code only
+                    | _ ->
+                        printfn "Uploading image %04x" tag
+                        reset ()
+                        frames |> List.iter comm.SendBytes
+                        compiler.EagerAssemble([Number (int16 tag); Token "save"]) |> fst |> exec
+                    rep' stack' t
+                | _ -> failwith "Malformed image syntax - usage: 'foo.txt image"
+            | "rom" ->
+                match stack with
+                | [Quotation [Token path]] :: [Quotation words] :: stack' ->
+                    let names = words |> List.map (function Token w -> w | _ -> failwith "Malformed rom syntax - words only")
+                    let image = compiler.ROM(names)
+                    File.WriteAllText(path, compiler.ROMHeader(image))
+                    printfn "Baked %i words (%i bytes) into %s" names.Length image.Length path
+                    reset ()
+                    rep' stack' t
+                | _ -> failwith "Malformed rom syntax - usage: [foo bar] 'BriefROM.h rom"
+            | "window" ->
+                match stack with
+                | [Number n] :: stack' ->
+                    comm.Window <- int n
+                    printfn "Window: %i frames%s" comm.Window (if comm.Window = 0 then " (plain frames)" else "")
+                    rep' stack' t
+                | _ -> failwith "Malformed window syntax - usage: 8 window"
             | "\\" -> rep' stack []
             | "." -> rep' stack (Number (int16 0xF0uy) :: Token "event" :: t)
             | "prompt" ->
@@ -200,6 +303,21 @@ let rec rep line =
             | "memory" | "mem" ->
                 printfn "Memory used: %i bytes" compiler.Address
                 rep' stack t
+            | "fusions" ->
+                compiler.Fusions |> List.iter (fun (seq, n) -> printfn "  %s: %i" seq n)
+                rep' stack t
+            | "calls" ->
+                compiler.Calls |> List.sortBy (snd >> (~-)) |> List.iter (fun (word, n) -> printfn "  %s: %i" word n)
+                rep' stack t
+            | "vectors" ->
+                match stack with
+                | [Quotation words] :: stack' ->
+                    let names = words |> List.map (function Token w -> w | _ -> failwith "Malformed vectors syntax - words only")
+                    let code, defs = compiler.Vectors(names)
+                    if defs.Length > 0 then comm.SendBytes(false, defs)
+                    if code.Length > 0 then exec code
+                    rep' stack' t
+                | _ -> failwith "Malformed vectors syntax - usage: [foo bar] vectors"
             | "go" ->
                 traceMode := true
                 printfn "Trace mode: %b" !traceMode
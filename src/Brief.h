@@ -1,63 +1,315 @@
-/* Brief.h
-
-Scriptable firmware for interfacing hardware with the .NET libraries and for
-running real time control loops. */
-
-#define __STDC_LIMIT_MACROS
-#include <Arduino.h>
-#include <Wire.h>
-
-#ifndef BRIEF_H
-#define BRIEF_H
-
-#define MEM_SIZE          1024  // dictionary space
-#define DATA_STACK_SIZE   8     // evaluation stack elements (int32s)
-#define RETURN_STACK_SIZE 8     // return and locals stack elements (int32s)
-
-#define MAX_PRIMITIVES    128   // max number of primitive (7-bit) instructions
-#define MAX_INTERRUPTS    6     // max number of ISR words
-
-#define BOOT_EVENT_ID     0xFF  // event sent upon 'setup' (not reset)
-#define VM_EVENT_ID       0xFE  // event sent upon VM error
-
-#define VM_ERROR_RETURN_STACK_UNDERFLOW 0
-#define VM_ERROR_RETURN_STACK_OVERFLOW  1
-#define VM_ERROR_DATA_STACK_UNDERFLOW   2
-#define VM_ERROR_DATA_STACK_OVERFLOW    3
-#define VM_ERROR_OUT_OF_MEMORY          4
-
-namespace brief
-{
-    /* The following setup() and loop() are expected to be added to the main *.ino
-    as you will find in Brief.ino. */
-
-    void setup(); // initialize everything, bind primitives
-    void loop(); // execute loop word (execute/define)
-
-    /* The following allow peeking/poking the Brief dictionary */
-
-    uint8_t memget(int16_t address); // fetch with bounds checking
-    void memset(int16_t address, uint8_t value); // store with bounds checking
-    // TODO: expose `here`, along with appending call, return, literal, etc.
-
-    /* The following get/set the program counter; allowing for deeply integrated external instructions
-    that fetch operands or do self-modification */
-
-    int16_t pget();
-    void pset(int16_t pp);
-
-    /* The following are meant for those wanting to bind their own functions into the Brief system.
-    New functions can be bound to the instruction table, they can push/pop data to interact with
-    other Brief instructions, and they may emit errors up to the PC. */
-
-    void bind(uint8_t i, void (*f)()); // add function to instruction table
-    void push(int16_t x); // push data to evaluation stack
-    int16_t pop(); // pop data from evaluation stack
-    void error(uint8_t code); // error events
-
-    /* If, for some reason, you want to manually execute Brief bytecode in memory */
-
-    void exec(int16_t address); // execute code at given address
-}
-
+/* Brief.h
+
+Scriptable firmware for interfacing hardware with the .NET libraries and for
+running real time control loops. */
+
+#define __STDC_LIMIT_MACROS
+#include <Arduino.h>
+#include <Wire.h>
+
+#ifndef BRIEF_H
+#define BRIEF_H
+
+#define DEFAULT_BAUD      19200 // serial speed with `setup()` (assumed by interactive)
+
+/* The default VM (behind the free functions below) is sized by the following. A board with RAM to
+spare may be given more; e.g. -DMEM_SIZE=16384 for a 16Kb dictionary on a Teensy. Further VMs may be
+instantiated with other sizes (see `brief::Machine` in BriefVM.h). */
+
+#ifndef MEM_SIZE
+#define MEM_SIZE          1024  // dictionary space (max 32768, or ROM_BASE with ROM)
+#endif
+#ifndef DATA_STACK_SIZE
+#define DATA_STACK_SIZE   8     // evaluation stack elements (cells)
+#endif
+#ifndef RETURN_STACK_SIZE
+#define RETURN_STACK_SIZE 8     // return and locals stack elements (cells)
+#endif
+#ifndef CELL_BITS
+#define CELL_BITS         16    // stack element (cell) width: 16 or 32
+#endif
+
+#define MAX_PRIMITIVES    128   // max number of primitive (7-bit) instructions
+#define MAX_EXTENSIONS    48    // max number of extended (`extension`-prefixed) instructions
+#define CORE_PRIMITIVES   93    // built-in instructions (0-99 reserved, bind() user instructions 100+)
+#define CALL_VECTORS      8     // single-byte calls through vector table (see `setVector`)
+#define VECTOR_CALL       85    // first of the vector call instructions
+#define MAX_INTERRUPTS    7     // max number of ISR words
+#define MAX_PIN_HANDLES   8     // max number of resolved pins (see `pinHandle`)
+#define MAX_WATCHES       8     // max number of watched pins (see `watchDigital` and the like)
+
+#define WATCH_DIGITAL     0     // watch kinds (see `watchDigital`, `watchAnalog`, `watchThreshold`)
+#define WATCH_ANALOG      1
+#define WATCH_THRESHOLD   2
+
+/* Pin handles access port registers directly where the core has them. PORT_IO is the width of the
+port registers (0 for none; falling back to the Arduino pin functions). PORT_LOCK/PORT_UNLOCK mask
+interrupts around read-modify-write of a register, restoring the previous state. */
+
+#ifndef PORT_IO
+#if defined(__AVR__)
+#define PORT_IO           8
+#define PORT_LOCK()       uint8_t portState = SREG; cli()
+#define PORT_UNLOCK()     SREG = portState
+#elif defined(ARDUINO_ARCH_SAMD)
+#define PORT_IO           32
+#define PORT_LOCK()       uint32_t portState = __get_PRIMASK(); __disable_irq()
+#define PORT_UNLOCK()     __set_PRIMASK(portState)
+#else
+#define PORT_IO           0
+#endif
+#endif
+
+#define ISR_DATA_STACK_SIZE   4 // interrupt context evaluation stack elements
+#define ISR_RETURN_STACK_SIZE 4 // interrupt context return stack elements
+#define ISR_QUEUE_SIZE        8 // max deferred interrupt words pending (power of two)
+#define ISR_EVENT_BUFFER_SIZE 16 // interrupt context event ring bytes (max 255)
+
+#define MAX_TASKS              4 // max cooperative task words (in addition to the loop word)
+#define TASK_DATA_STACK_SIZE   4 // per-task evaluation stack elements
+#define TASK_RETURN_STACK_SIZE 4 // per-task return stack elements
+
+/* The execution engine used by `run()` is selected at compile time. The function table is the
+smallest. The switch and threaded engines inline the core primitives and keep the VM registers in
+locals; falling back to the function table only for bound instructions (CORE_PRIMITIVES and above).
+Threaded dispatch relies on the GCC "labels as values" extension (computed goto). */
+
+#define DISPATCH_TABLE    0     // indirect call through instruction table per bytecode
+#define DISPATCH_SWITCH   1     // inline switch-based interpreter (any compiler)
+#define DISPATCH_THREADED 2     // inline computed-goto interpreter (GCC)
+
+#ifndef DISPATCH
+#define DISPATCH          DISPATCH_TABLE
+#endif
+
+#ifndef TOS_CACHE
+#define TOS_CACHE         0     // inline engines keep top of data stack in a register (1) or not (0)
+#endif
+
+#if DISPATCH == DISPATCH_THREADED && !defined(__GNUC__)
+#undef DISPATCH
+#define DISPATCH          DISPATCH_SWITCH // computed goto unavailable
+#endif
+
+/* Code sent from the PC may optionally be verified upon receipt. Code failing verification is
+rejected with a VM error event rather than being committed or executed. The stack effects of verified
+definitions are remembered and, with an inline engine, words known not to over/underflow run with
+bounds checks elided. */
+
+#ifndef VERIFY
+#define VERIFY            0     // verify received code (1) or not (0)
+#endif
+#define VERIFIED_WORDS    16    // max definitions for which stack effects are remembered
+
+/* An optional profiling build counts executions of each opcode and calls to each word, and
+accumulates time spent in each word run by `exec` (loop word, tasks, interrupt words). The clock
+defaults to `micros()` but may be any free-running 32-bit counter (e.g. `DWT->CYCCNT` on Cortex-M).
+Compiled out, the profiler costs nothing. */
+
+#ifndef PROFILE
+#define PROFILE           0     // count opcodes and word calls/time (1) or not (0)
+#endif
+#ifndef PROFILE_CLOCK
+#define PROFILE_CLOCK()   micros() // time base for per-word profiling
+#endif
+#define PROFILED_WORDS    16    // max words for which calls and time are counted
+
+/* The loop word and tasks may optionally be run on a budget, of instructions and/or microseconds per
+run (see `budget`), so that a long-running word can't starve serial input and events. A word out of
+budget is suspended and resumed upon the next pass of `loop()`. The clock is read every BUDGET_CHECK
+instructions given a time budget. Compiled out, the budget costs nothing; compiled in, a count per
+instruction. */
+
+#ifndef BUDGET
+#define BUDGET            0     // suspend loop word and tasks out of budget (1) or not (0)
+#endif
+#ifndef BUDGET_MICROS
+#define BUDGET_MICROS     2000  // default time budget per run (0 for none)
+#endif
+#define BUDGET_CHECK      32    // instructions between readings of the clock
+
+/* An optional tracing build records each instruction executed (address, opcode and top of stack, along
+with the TRACE_CLOCK time since the one before) in a ring of the last TRACE_DEPTH, so that what ran up to
+a missed deadline may be frozen and dumped (see `dumpTrace`) and the call tree rebuilt at the PC. Compiled
+out, tracing costs nothing; compiled in, a record per instruction. */
+
+#ifndef TRACE
+#define TRACE             0     // record instructions executed (1) or not (0)
+#endif
+#ifndef TRACE_DEPTH
+#define TRACE_DEPTH       32    // instructions kept in trace ring (power of two)
+#endif
+#ifndef TRACE_TIME
+#define TRACE_TIME        1     // record time between instructions (1) or not (0)
+#endif
+#ifndef TRACE_CLOCK
+#define TRACE_CLOCK()     micros() // time base for tracing
+#endif
+
+/* Library words may be baked into flash and executed in place (see `rom()` below), reached by calls
+at and above ROM_BASE. The dictionary must lie below it (MEM_SIZE <= ROM_BASE). */
+
+#ifndef ROM
+#define ROM               1     // execute image in flash at ROM_BASE (1) or not (0)
+#endif
+#ifndef ROM_BASE
+#define ROM_BASE          0x4000 // address of flash image (assumed by the compiler)
+#endif
+
+/* The dictionary (along with the loop word and ISR table) may be saved to EEPROM and restored; by
+default automatically upon `setup()` so that a board runs on its own without the PC. The image is
+checked by CRC and format version before being restored. Available where the core has EEPROM.h. */
+
+#ifndef PERSIST
+#if defined(__AVR__)
+#define PERSIST           1     // save/restore dictionary image in EEPROM (1) or not (0)
+#else
+#define PERSIST           0
+#endif
+#endif
+#ifndef PERSIST_AUTO_RESTORE
+#define PERSIST_AUTO_RESTORE 1  // restore saved image upon `setup()` (1) or not (0)
+#endif
+#ifndef PERSIST_ADDRESS
+#define PERSIST_ADDRESS   0     // EEPROM offset of saved image
+#endif
+#define PERSIST_VERSION   2     // image format (images of other versions are not restored)
+
+#if PERSIST
+#include <EEPROM.h>
+#endif
+
+/* Outgoing events are queued in a ring buffer and transmitted as the serial port has room rather
+than blocking the VM. Should the ring fill, the policy is to drop the new event, to discard the
+oldest queued events to make room or to drop the new event and raise a VM error event. */
+
+#define EVENT_BUFFER_SIZE 64    // outgoing event ring buffer bytes (max 255)
+
+#define EVENT_DROP_NEWEST 0     // drop event not fitting
+#define EVENT_DROP_OLDEST 1     // discard oldest queued events to make room
+#define EVENT_ERROR       2     // drop event not fitting and raise VM error
+
+#ifndef EVENT_OVERFLOW
+#define EVENT_OVERFLOW    EVENT_DROP_NEWEST
+#endif
+
+/* Telemetry samples (fixed records of int16 channels) may be batched with `telemetry` into frames
+of delta/varint encoded records; each frame sent as a single event. */
+
+#define TELEMETRY_CHANNELS   8  // max channels per telemetry record
+#define TELEMETRY_FRAME_SIZE 48 // max telemetry frame bytes (must fit event buffer)
+
+#if TELEMETRY_FRAME_SIZE > EVENT_BUFFER_SIZE - 2
+#error "Telemetry frame must fit event buffer (along with length and ID)"
+#endif
+
+#define ACQUIRE_CHANNELS     8  // max analog channels per acquisition frame (see `acquire`)
+
+/* Code may be sent in sequenced frames (see `loop()` in BriefVM.h), each checked by CRC and
+acknowledged, so that the PC may keep several in flight and resend those lost. A sequenced frame
+abandoned part way (e.g. its length mangled) is given up on after FRAME_TIMEOUT. */
+
+#ifndef ACKED_FRAMES
+#define ACKED_FRAMES      1     // accept sequenced, acknowledged frames (1) or only plain frames (0)
+#endif
+#define FRAME_TIMEOUT     100   // milliseconds without a byte before abandoning sequenced frame
+
+#ifndef WIRE_TIMEOUT
+#define WIRE_TIMEOUT      1000  // microseconds awaiting each received I2C byte
+#endif
+
+#define BOOT_EVENT_ID     0xFF  // event sent upon 'setup' (not reset)
+#define VM_EVENT_ID       0xFE  // event sent upon VM error
+#define TELEMETRY_EVENT_ID 0xFD // event containing batched telemetry frame
+#define LOOP_STATS_EVENT_ID 0xFC // event containing loop word timing statistics
+#define PROFILE_EVENT_ID  0xFB  // event containing chunk of profile (PROFILE)
+#define IMAGE_EVENT_ID    0xFA  // event containing tag of saved dictionary image (PERSIST)
+#define ACK_EVENT_ID      0xF9  // event acknowledging sequenced frame (ACKED_FRAMES)
+#define TRACE_EVENT_ID    0xF8  // event containing chunk of trace (TRACE)
+
+#define VM_ERROR_RETURN_STACK_UNDERFLOW 0
+#define VM_ERROR_RETURN_STACK_OVERFLOW  1
+#define VM_ERROR_DATA_STACK_UNDERFLOW   2
+#define VM_ERROR_DATA_STACK_OVERFLOW    3
+#define VM_ERROR_OUT_OF_MEMORY          4
+#define VM_ERROR_INVALID_CODE           5
+#define VM_ERROR_EVENT_OVERFLOW         6
+
+#include "BriefVM.h"
+
+namespace brief
+{
+#if CELL_BITS == 32
+    typedef int32_t cell; // stack element of the default VM
+#else
+    typedef int16_t cell; // stack element of the default VM
+#endif
+
+    typedef Machine<MEM_SIZE, DATA_STACK_SIZE, RETURN_STACK_SIZE, cell> DefaultMachine;
+
+    extern DefaultMachine vm; // default instance (behind the functions below)
+
+    /* The following setup() and loop() are expected to be added to the main *.ino
+    as you will find in Brief.ino.
+
+    Code is received and events are sent over a transport Stream; by default `Serial` at
+    DEFAULT_BAUD. Any other port or speed may be given (e.g. `brief::setup(Serial1, 115200)`). On
+    native USB boards (e.g. Teensy) the speed is ignored and the link runs at full USB speed. A Stream
+    already begun may be given directly, including custom Stream implementations (e.g. over SPI).
+    Events are written as the Stream reports room (`availableForWrite()`). Streams not reporting room
+    should be given as `blocking`, in which case queued events are written out regardless. */
+
+    void setup(); // initialize everything over Serial at DEFAULT_BAUD, bind primitives
+    void setup(Stream& stream, bool blocking = false); // initialize over given (begun) stream
+
+    template <typename Port>
+    void setup(Port& port, unsigned long baud) // initialize over given port at given speed
+    {
+        vm.setup(port, baud);
+    }
+
+    void loop(); // execute loop word (execute/define)
+
+    /* The following allow peeking/poking the Brief dictionary */
+
+    uint8_t memget(int16_t address); // fetch with bounds checking
+    void memset(int16_t address, uint8_t value); // store with bounds checking
+    // TODO: expose `here`, along with appending call, return, literal, etc.
+
+    /* The following get/set the program counter; allowing for deeply integrated external instructions
+    that fetch operands or do self-modification */
+
+    int16_t pget();
+    void pset(int16_t pp);
+
+    /* The following are meant for those wanting to bind their own functions into the Brief system.
+    New functions can be bound to the instruction table, they can push/pop data to interact with
+    other Brief instructions, and they may emit errors up to the PC. */
+
+    void bind(uint8_t i, void (*f)()); // add function to instruction table
+    void bindExtension(uint8_t i, void (*f)()); // add function to extended instruction table
+    void push(cell x); // push data to evaluation stack
+    cell pop(); // pop data from evaluation stack
+    void error(uint8_t code); // error events
+
+    /* If, for some reason, you want to manually execute Brief bytecode in memory */
+
+    void exec(int16_t address); // execute code at given address
+
+#if ROM
+    /* Library words compiled ahead of time (BriefROM.h generated by the compiler) are given as an image
+    in flash, executed in place at ROM_BASE. Register it before `setup()`:
+
+        #include "BriefROM.h"
+
+        void setup()
+        {
+            brief::rom(briefROM, sizeof(briefROM));
+            brief::setup();
+        } */
+
+    void rom(const uint8_t* image, uint16_t length); // execute image in flash (PROGMEM) at ROM_BASE
+#endif
+}
+
 #endif // BRIEF_H
\ No newline at end of file
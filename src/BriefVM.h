@@ -0,0 +1,4005 @@
+/* BriefVM.h
+
+The Brief VM itself, as a class template (included by Brief.h, after the configuration). */
+
+#ifndef BRIEF_VM_H
+#define BRIEF_VM_H
+
+namespace brief
+{
+    /* The Brief VM revolves around a pair of stacks and a block of memory serving as a dictionary of
+    subroutines.
+
+    The dictionary is typically 1Kb. This is where Brief byte code is stored and executed. While it
+    can technically be used as general purpose memory, the intent is to treat it as a structured
+    space for definitions; subroutines, variables, and the like, all contiguously packed.
+
+    The two stacks are each eight elements (cells) of 16-bit signed integers by default. They are used
+    to store data and addresses. They are connected in that elements can be popped from the top of one and pushed
+    to the top of the other.
+
+    One stack is used as a data stack; persisting values across instructions and subroutine calls.
+    With very few exceptions, instructions get their operands only from the data stack. All
+    parameter passing between subroutines is done via this stack.
+
+    The other stack is used by the VM as a return stack. The program counter is pushed here before
+    jumping into a subroutine and is popped to return. Be careful not to nest subroutines more than
+    eight levels deep! Note that infinite tail recursion is possible none-the-less.
+
+    The stacks in use are referenced by base (`dstack`/`rstack`) and limit (`dlimit`/`rlimit`)
+    pointers. Normally these are the main stacks, but interrupt routines switch to their own
+    smaller stacks (see `interrupt()` below) so as not to disturb the interrupted code.
+
+    The VM is a class template, parameterized on the dictionary size, the stack depths and the cell
+    type (int16_t or int32_t). All of its state is held in members and the bounds are compile time
+    constants, so that bounds checks compile down to comparisons against immediates just as they did
+    with #defines. A board with plenty of RAM may be given a larger dictionary while a small one keeps
+    1Kb, and more than one VM may run side by side (e.g. a small sandbox for untrusted code next to the
+    main VM). The default instance `brief::vm` is behind the free functions of Brief.h.
+
+    Instances should have static storage duration (be globals) so that they begin zeroed. Each is
+    driven by its own `setup`/`loop`. Built-in instructions reach the instance currently running through
+    `current` (see `thunk` below); instructions bound by the hosting project into other than the
+    default VM should use that instance's `push`/`pop` rather than the free functions. Interrupts and
+    Wire events are global resources and so are routed to whichever instance last attached them. */
+
+    template <typename Cell> struct Wider; // double-width type of cell (for intermediates)
+    template <> struct Wider<int16_t> { typedef int32_t type; };
+    template <> struct Wider<int32_t> { typedef int64_t type; };
+
+#if VERIFY
+#define EFFECT_UNKNOWN 0xFF // dynamic stack effect (verifier)
+
+    extern const uint8_t effects[CORE_PRIMITIVES] PROGMEM; // primitive stack effects (Brief.cpp)
+#endif
+
+    template <uint16_t MemSize, uint8_t DataStackSize, uint8_t ReturnStackSize, typename Cell>
+    class Machine
+    {
+        static_assert(MemSize <= 0x8000, "Dictionary must be 15-bit addressable");
+        static_assert(sizeof(Cell) == 2 || sizeof(Cell) == 4, "Cells must be 16- or 32-bit");
+#if ROM
+        static_assert(MemSize <= ROM_BASE, "Dictionary must lie below the flash region (ROM_BASE)");
+#endif
+
+    public:
+        // Memory (dictionary)
+
+        uint8_t memory[MemSize]; // dictionary (and local/arg space for IL semantics)
+
+        /* Addresses at and above ROM_BASE (ROM) reach a read-only image in flash rather than the RAM
+        dictionary; typically a library of stable words baked in at build time (BriefROM.h, generated by
+        the compiler). The image is executed in place and its words are called like any others, while
+        RAM is left for definitions sent down from the PC. Stores into the image raise an out of memory
+        error, as do fetches beyond its end. Everything reaches flash through `memget` only once the
+        address falls outside of RAM, so the RAM dictionary pays nothing for it. Block instructions
+        (`fill`, `move`, ...) are limited to RAM. */
+
+#if ROM
+        const uint8_t* romImage = 0; // image in flash (PROGMEM) at ROM_BASE
+        uint16_t romLength = 0; // bytes of image
+
+        void rom(const uint8_t* image, uint16_t length) // execute image in flash in place at ROM_BASE
+        {
+            romImage = image;
+            romLength = length <= 0x8000 - ROM_BASE ? length : 0x8000 - ROM_BASE; // 15-bit addressable
+        }
+#endif
+
+        uint8_t memget(int16_t address) // fetch with bounds checking
+        {
+            if (address < 0 || address >= MemSize)
+            {
+#if ROM
+                if ((uint16_t)(address - ROM_BASE) < romLength) return pgm_read_byte(romImage + (address - ROM_BASE));
+#endif
+                error(VM_ERROR_OUT_OF_MEMORY);
+                return 0;
+            }
+
+            return memory[address];
+        }
+
+        void memset(int16_t address, uint8_t value) // store with bounds checking
+        {
+            if (address >= MemSize)
+            {
+                error(VM_ERROR_OUT_OF_MEMORY);
+            }
+            else
+            {
+                memory[address] = value;
+            }
+        }
+
+        // Data stack
+
+        Cell dmain[DataStackSize + 1]; // eval stack (and args in Brief semantics, [0] unused)
+
+        Cell* dstack = dmain; // base of data stack in use
+        Cell* dlimit = dmain + DataStackSize; // last element of data stack in use
+        Cell* s = dmain; // data stack pointer (empty when s == dstack)
+
+        void push(Cell x)
+        {
+            if (s >= dlimit)
+            {
+                error(VM_ERROR_DATA_STACK_OVERFLOW);
+            }
+            else
+            {
+                *(++s) = x;
+            }
+        }
+
+        Cell pop()
+        {
+            if (s <= dstack)
+            {
+                error(VM_ERROR_DATA_STACK_UNDERFLOW);
+                return 0;
+            }
+            else
+            {
+                return *s--;
+            }
+        }
+
+        // Return stack
+
+        Cell rmain[ReturnStackSize + 1]; // return stack (and locals in Brief, [0] unused)
+
+        Cell* rstack = rmain; // base of return stack in use
+        Cell* rlimit = rmain + ReturnStackSize; // last element of return stack in use
+        Cell* r = rmain; // return stack pointer (empty when r == rstack)
+
+        void rpush(Cell x)
+        {
+            if (r >= rlimit)
+            {
+                error(VM_ERROR_RETURN_STACK_OVERFLOW);
+            }
+            else
+            {
+                *(++r) = x;
+            }
+        }
+
+        Cell rpop()
+        {
+            if (r <= rstack)
+            {
+                error(VM_ERROR_RETURN_STACK_UNDERFLOW);
+                return 0;
+            }
+            else
+            {
+                return *r--;
+            }
+        }
+
+        /* Brief instructions are single bytes with the high bit reset:
+
+          0xxxxxxx
+
+        The lower seven bits become essentially an index into a function table. Each may consume
+        and/or produce values on the data stack as well as having other side effects. Only three
+        instructions manipulate the return stack. Two are `push` and `pop` which move values between the
+        data and return stack. The third is (return); popping an address at which execution continues.
+
+        It is extremely common to factor out redundant sequences of code into subroutines. The `call`
+        instruction is not used for general subroutine calls. Instead, if the high bit is set then the
+        following byte is taken and together (in little endian), with the high bit reset, they become
+        an address to be called.
+
+          1xxxxxxxxxxxxxxx
+
+        This allows 15-bit addressing to definitions in the dictionary.
+
+        Upon calling, the VM pushes the current program counter to the return stack. There is a `return`
+        instruction, used to terminate definitions, which pops the return stack to continue execution
+        after the call. */
+
+        void (*instructions[MAX_PRIMITIVES])(); // instruction function table
+
+        void bind(uint8_t i, void (*f)()) // add function to instruction table
+        {
+            instructions[i] = f;
+        }
+
+        /* Less frequently used instructions (configuration, diagnostics, ...) are extended instructions
+        so as not to use up the single-byte instruction space. These are the `extension` instruction
+        followed by a byte indexing a second function table:
+
+          0x44 iiiiiiii */
+
+        void (*extensions[MAX_EXTENSIONS])(); // extended instruction function table
+
+        void bindExtension(uint8_t i, void (*f)()) // add function to extended instruction table
+        {
+            extensions[i] = f;
+        }
+
+        /* Built-in instructions are members and so are bound to the tables through thunks; plain
+        functions calling the member upon the instance running (`current`, set by `run()`). */
+
+        static Machine* current; // instance running code
+
+        template <void (Machine::*F)()>
+        static void thunk() // instruction function for member F
+        {
+            (current->*F)();
+        }
+
+        int16_t p; // program counter (VM instruction pointer)
+
+        int16_t pget()
+        {
+            return p;
+        }
+
+        void pset(int16_t pp)
+        {
+            p = pp;
+        }
+
+        void ret() // return instruction
+        {
+            p = rpop();
+        }
+
+        /* With PROFILE, the engines count each opcode fetched and each call target jumped to. Words
+        entered by `exec` (loop word, tasks, interrupt words; but not immediate code) are counted as calls
+        too and the PROFILE_CLOCK time spent within them (inclusive of words they call) accumulated. Counts
+        saturate. Word slots are claimed in order of first call, up to PROFILED_WORDS. */
+
+#if PROFILE
+        uint16_t profileOps[MAX_PRIMITIVES]; // executions per opcode
+        int16_t profileAddresses[PROFILED_WORDS]; // addresses of profiled words (-1 unclaimed)
+        uint16_t profileCalls[PROFILED_WORDS]; // calls per word
+        uint32_t profileTimes[PROFILED_WORDS]; // time within word (entered by `exec`)
+
+        inline void profileOp(uint8_t i) // count opcode execution (helper)
+        {
+            if (i < MAX_PRIMITIVES && profileOps[i] != UINT16_MAX) profileOps[i]++;
+        }
+
+        int8_t profileWord(int16_t address) // slot for word, claiming one if needed (-1 if full) (helper)
+        {
+            for (uint8_t i = 0; i < PROFILED_WORDS; i++)
+            {
+                if (profileAddresses[i] == address) return i;
+                if (profileAddresses[i] == -1)
+                {
+                    profileAddresses[i] = address;
+                    return i;
+                }
+            }
+            return -1;
+        }
+
+        void profileCall(int16_t address) // count call to word (helper)
+        {
+            int8_t i = profileWord(address);
+            if (i >= 0 && profileCalls[i] != UINT16_MAX) profileCalls[i]++;
+        }
+
+#define PROFILE_OP(i) profileOp(i)
+#define PROFILE_CALL(a) profileCall(a)
+#else
+#define PROFILE_OP(i)
+#define PROFILE_CALL(a)
+#endif
+
+        /* With TRACE, the engines record each instruction as it is fetched: its address, opcode (for a
+        call, the high byte of the address called, with 0x80) and the top of the data stack beforehand (as an
+        int16). With TRACE_TIME, the TRACE_CLOCK time since the previous record (saturating) is kept too; the
+        time taken by the previous instruction, that is. Recording stops while the ring is frozen (see
+        `dumpTrace`). */
+
+#if TRACE
+        struct Trace // record of instruction executed
+        {
+            int16_t address; // of instruction
+            uint8_t opcode;  // instruction (or high byte of call)
+            int16_t tos;     // top of stack beforehand
+#if TRACE_TIME
+            uint16_t delta;  // time since previous record
+#endif
+        };
+
+        Trace traceRing[TRACE_DEPTH];
+        uint16_t traceNext = 0; // slot to record next
+        uint16_t traceLength = 0; // records held (up to TRACE_DEPTH)
+        bool traceFrozen = false;
+#if TRACE_TIME
+        uint32_t traceTime; // clock at previous record
+#endif
+
+        inline void traceOp(int16_t address, uint8_t i, Cell tos) // record instruction (helper)
+        {
+            if (traceFrozen) return;
+            Trace& t = traceRing[traceNext];
+            traceNext = (traceNext + 1) & (TRACE_DEPTH - 1);
+            if (traceLength < TRACE_DEPTH) traceLength++;
+            t.address = address;
+            t.opcode = i;
+            t.tos = tos;
+#if TRACE_TIME
+            uint32_t now = TRACE_CLOCK();
+            uint32_t delta = now - traceTime;
+            traceTime = now;
+            t.delta = delta > UINT16_MAX ? UINT16_MAX : delta;
+#endif
+        }
+
+#define TRACE_OP(a, i, t) traceOp(a, i, t)
+#else
+#define TRACE_OP(a, i, t)
+#endif
+
+#if DISPATCH == DISPATCH_TABLE
+
+        void run() // run code at p
+        {
+            Machine* m = current;
+            current = this;
+            int16_t i;
+            do
+            {
+#if BUDGET
+                if (--countdown == 0 && spent()) // out of budget
+                {
+                    suspend();
+                    break;
+                }
+#endif
+                i = memget(p++);
+                TRACE_OP(p - 1, i, *s);
+                if ((i & 0x80) == 0) // instruction?
+                {
+                    PROFILE_OP(i);
+                    instructions[i](); // execute instruction
+                }
+                else // address to call
+                {
+                    if (memget(p + 1) != 0) // not followed by return (TCO)
+                        rpush(p + 1); // return address
+                    p = ((i << 8) & 0x7F00) | memget(p); // jump
+                    PROFILE_CALL(p);
+                }
+            } while (p >= 0); // -1 pushed to return stack
+            current = m;
+        }
+
+#endif // (inline engines defined after the primitives)
+
+        void exec(int16_t address) // execute code at given address
+        {
+#if PROFILE
+            uint32_t start = PROFILE_CLOCK();
+#endif
+            r = rstack; // reset return stack
+            rpush(-1); // causing `run()` to fall through upon completion
+            p = address;
+#if VERIFY && DISPATCH != DISPATCH_TABLE
+            if (bounded(address)) runUnchecked(); // stacks known not to over/underflow
+            else
+#endif
+            run();
+#if PROFILE
+            if (address < last) // definition (not immediate code)
+            {
+                int8_t i = profileWord(address);
+                if (i < 0) return;
+                if (profileCalls[i] != UINT16_MAX) profileCalls[i]++;
+                profileTimes[i] += PROFILE_CLOCK() - start;
+            }
+#endif
+        }
+
+        /* As the dictionary is filled `here` points to the next available byte, while `last` points to the
+        byte following the previously commited definition. This way the dictionary also acts as a scratch
+        buffer; filled with "immediate mode" instructions, then rolled back to `last`. */
+
+        int16_t here; // dictionary 'here' pointer
+        int16_t last; // last definition address
+
+        /* Code sent down from the PC may optionally be verified (VERIFY) before being committed as a
+        definition or executed immediately. Verification walks the new bytecode checking that:
+
+          - Operands (literals, quotation lengths, `next` and branch offsets) lie within the new code
+          - Quotations lie entirely within the new code and `next` loops back within the definition
+          - Branches land within the new code and forward branches at the top level of a definition land
+            on an instruction boundary within that definition
+          - Calls land within previously committed definitions (or recurse to the current one) or flash
+          - Instructions are bound (no calling through empty instruction table entries)
+
+        Code failing verification is rejected with a VM error event (VM_ERROR_INVALID_CODE) before it ever
+        runs.
+
+        While walking, the stack effect of each definition is computed from a table of primitive stack
+        effects (`effects`) and from the effects of the definitions it calls. This gives the number of elements taken
+        from the data stack upon entry and the maximum growth of either stack. Anything dynamic (`call`,
+        `choice`, `if`, `pick`, `next` loops, recursion, user instructions, calls into flash, ...) makes the
+        effect unknown. So does a call or `return` with values pushed to the return stack (the return
+        address then being a pushed value, leading to code never verified).
+        Forward branches are followed by remembering the depths at each pending target (up to
+        VERIFIED_BRANCHES) and checking that both paths agree where they merge.
+        Known effects are remembered (up to VERIFIED_WORDS) and, upon `exec` of such a word, if the current
+        stack depths leave enough room then the unchecked engine is used.
+
+        Note that this assumes code is not later modified in place (by `c!`/`!`). Verified code is
+        "forgotten" along with the dictionary. */
+
+#if VERIFY
+
+#define VERIFIED_BRANCHES 8 // pending forward branches tracked per definition
+
+        struct Effect // stack effect of a verified definition
+        {
+            int16_t address; // start of definition
+            uint8_t in;      // data stack elements taken (depth required upon entry)
+            int8_t net;      // change in data stack depth
+            uint8_t peak;    // max data stack growth above depth upon entry
+            uint8_t rpeak;   // max return stack growth (beyond return address)
+        };
+
+        Effect verified[VERIFIED_WORDS]; // ordered by address
+        uint8_t verifiedCount = 0;
+
+        const Effect* effectOf(int16_t address) // helper (not Brief instruction)
+        {
+            for (uint8_t i = 0; i < verifiedCount; i++)
+            {
+                if (verified[i].address == address) return &verified[i];
+            }
+            return 0;
+        }
+
+        bool bounded(int16_t address) // whether word at address is known to fit current stacks
+        {
+            const Effect* e = effectOf(address);
+            return e &&
+                   s - dstack >= e->in &&
+                   s + e->peak <= dlimit &&
+                   r + e->rpeak <= rlimit;
+        }
+
+        void unverify(int16_t address) // forget effects of definitions at or above address
+        {
+            while (verifiedCount > 0 && verified[verifiedCount - 1].address >= address)
+            {
+                verifiedCount--;
+            }
+        }
+
+        void remember(int16_t address, int16_t low, int16_t net, int16_t high, int16_t rhigh)
+        {
+            // only worth remembering if it can ever fit
+            if (verifiedCount < VERIFIED_WORDS &&
+                high - low <= DataStackSize &&
+                rhigh < ReturnStackSize)
+            {
+                Effect* e = &verified[verifiedCount++];
+                e->address = address;
+                e->in = -low;
+                e->net = net;
+                e->peak = high;
+                e->rpeak = rhigh;
+            }
+        }
+
+        bool verify(int16_t start, int16_t end) // verify code in [start, end), remembering effects
+        {
+            int16_t def = start; // current definition
+            int16_t outer = start; // end of outermost quotation
+            int16_t depth = 0, low = 0, high = 0, rdepth = 0, rhigh = 0;
+            bool known = true;
+            int16_t targets[VERIFIED_BRANCHES]; // pending forward branch targets
+            int16_t depths[VERIFIED_BRANCHES], rdepths[VERIFIED_BRANCHES]; // depths upon branching
+            uint8_t pending = 0;
+            bool live = true; // reachable by falling through (not following `branch`)
+            int16_t a = start;
+            if (end > MemSize) goto invalid;
+            while (a < end)
+            {
+                bool top = a >= outer; // at top level of the definition (not within quotation)
+                if (top) // merge with branches landing here
+                {
+                    for (uint8_t b = 0; b < pending;)
+                    {
+                        if (targets[b] == a)
+                        {
+                            if (!live)
+                            {
+                                depth = depths[b];
+                                rdepth = rdepths[b];
+                                live = true;
+                            }
+                            else if (depths[b] != depth || rdepths[b] != rdepth) known = false; // unbalanced
+                            pending--;
+                            targets[b] = targets[pending];
+                            depths[b] = depths[pending];
+                            rdepths[b] = rdepths[pending];
+                        }
+                        else b++;
+                    }
+                    if (!live) known = false; // unreachable code
+                    live = true;
+                }
+                int16_t target = 0; // of branch
+                uint8_t i = memory[a++];
+                if (i & 0x80 || (i >= VECTOR_CALL && i < VECTOR_CALL + CALL_VECTORS)) // call (or through vector)
+                {
+                    int16_t target;
+                    if (i & 0x80)
+                    {
+                        if (a >= end) goto invalid;
+                        target = ((i << 8) & 0x7F00) | memory[a++];
+                        if (target > def && !(ROM && target >= ROM_BASE)) goto invalid; // neither committed nor recursive (nor flash)
+                    }
+                    else if ((target = vectors[i - VECTOR_CALL]) == -1) goto invalid; // unbound vector
+                    if (top && known)
+                    {
+                        // return stack must be as upon entry (or the callee returns into a value pushed)
+                        const Effect* e = target == def || rdepth != 0 ? 0 : effectOf(target);
+                        if (e)
+                        {
+                            bool tail = a < end && memory[a] == 0; // TCO (no return address pushed)
+                            if (depth - e->in < low) low = depth - e->in;
+                            if (depth + e->peak > high) high = depth + e->peak;
+                            depth += e->net;
+                            if (rdepth + !tail + e->rpeak > rhigh) rhigh = rdepth + !tail + e->rpeak;
+                        }
+                        else known = false;
+                    }
+                    continue;
+                }
+                if (i >= CORE_PRIMITIVES)
+                {
+                    if (instructions[i] == 0) goto invalid; // unbound
+                    known = false;
+                    continue;
+                }
+                switch (i)
+                {
+                    case 0: // return
+                        if (top)
+                        {
+                            if (pending) goto invalid; // branch out of definition (or into instruction)
+                            if (known && rdepth == 0) remember(def, low, depth, high, rhigh); // else returns into value pushed
+                            def = a; // next definition (if any)
+                            depth = low = high = rdepth = rhigh = 0;
+                            known = true;
+                        }
+                        continue;
+                    case 68: // extension
+                        if (a >= end || memory[a] >= MAX_EXTENSIONS || extensions[memory[a]] == 0) goto invalid;
+                        // fall through
+                    case 1: // lit8
+                    case 60: // lit8Add
+                    case 61: // lit8Fetch16
+                    case 63: // lit8DigitalRead
+                        a++;
+                        break;
+                    case 2: // lit16
+                        a += 2;
+                        break;
+                    case 3: // quote
+                        if (a >= end || a + 1 + memory[a] > end) goto invalid;
+                        if (top) outer = a + 1 + memory[a];
+                        a++; // walk into the quotation too
+                        break;
+                    case 38: // pushr
+                        rdepth++;
+                        break;
+                    case 39: // popr
+                        rdepth--;
+                        break;
+                    case 58: // next
+                        if (a >= end || a - 1 - memory[a] < def) goto invalid; // loops within definition
+                        a++;
+                        break;
+                    case 66: // zbranch
+                    case 67: // branch
+                        if (a >= end) goto invalid;
+                        target = a + 1 + (int8_t)memory[a];
+                        if (target < def || target >= end) goto invalid; // within definition
+                        if (target <= a) known = false; // backward (loop)
+                        a++;
+                        break;
+                }
+                if (a > end) goto invalid;
+                if (top && known)
+                {
+                    uint8_t e = pgm_read_byte(&effects[i]);
+                    if (e == EFFECT_UNKNOWN || rdepth < 0)
+                    {
+                        known = false;
+                    }
+                    else
+                    {
+                        depth -= e >> 4;
+                        if (depth < low) low = depth;
+                        depth += e & 0x0F;
+                        if (depth > high) high = depth;
+                        if (rdepth > rhigh) rhigh = rdepth;
+                    }
+                }
+                if (top && target > a) // forward branch
+                {
+                    if (pending < VERIFIED_BRANCHES)
+                    {
+                        targets[pending] = target;
+                        depths[pending] = depth;
+                        rdepths[pending] = rdepth;
+                        pending++;
+                    }
+                    else known = false; // too deeply nested to follow (targets not checked)
+                    if (i == 67) live = false;
+                }
+            }
+            if (def == end) return true; // all definitions terminated
+
+        invalid:
+            error(VM_ERROR_INVALID_CODE);
+            return false;
+        }
+
+#undef VERIFIED_BRANCHES
+
+#else
+
+        bool verify(int16_t, int16_t) { return true; } // verification disabled
+        void unverify(int16_t) {}
+
+#endif // VERIFY
+
+        /* Events are used to send unsolicited data up to the PC. Requests may cause events, but it is
+        not a request/response model. That is, the event is always async and is not correlated with a
+        particular request (at the protocol level).
+
+        The payload is a zero- or single-byte identifier followed by an arbitrary number of data bytes.
+        This is prefixed by a length header byte, indicating the length of the data (excluding ID).
+
+          Length: 1 byte
+          ID:     1 byte
+          Data:   n bytes (0, 1, 2 or 4)
+
+        Events may be considered simple signed scalar values generated by the event instruction. In this
+        case the data bytes consist of 0-, 1- or 2-bytes depending on the value taken from the stack.
+        The value 0 is transmitted as zero-length data and may be used when the ID alone is enough
+        information to signal an event. Other values have various lengths:
+
+          x = 0                   0 bytes
+          -128 >= x <= 127        1 byte
+          otherwise               2 bytes (or 4 beyond int16 with 32-bit cells)
+
+        Events may instead be hand packed records of data, such as a "heartbeat" of sensor data. This is
+        produced using the `eventHeader` and `eventFooter` instructions. Event data may be included using
+        `eventBody8`/`eventBody16`.
+
+        Events are packed directly into a ring buffer (beyond those already queued) and committed to the
+        queue by `eventFooter`. Queued events are transmitted by `drain()` as the serial port has room;
+        opportunistically after each event and upon each pass of `loop()`. The VM never waits on the UART
+        (a 6-byte heartbeat would otherwise cost ~3ms at 19200 baud).
+
+        Events are queued whole. Should an event not fit, it is dropped (EVENT_DROP_NEWEST), the oldest
+        queued events are discarded to make room (EVENT_DROP_OLDEST) or it is dropped and a VM error is
+        raised (EVENT_ERROR). VM error events themselves always make room. An event partly transmitted
+        is first finished (blocking) before being discarded. Dropped events are counted and the count
+        retrieved with `eventsDropped`.
+
+        Should an event be started while another is being packed (e.g. an error raised between
+        `eventHeader` and `eventFooter`) then the partial event is dropped. Body and footer instructions
+        with no header are ignored. */
+
+        Stream* transport = &Serial; // code received and events sent (see `setup()`)
+        bool transportBlocking = false; // whether to write regardless of room reported by transport
+
+        uint8_t events[EVENT_BUFFER_SIZE]; // ring buffer of queued events (length, ID, data)
+        uint8_t eventHead = 0; // next byte to transmit
+        uint8_t eventQueued = 0; // bytes queued (committed) beginning at head
+        uint8_t eventInFlight = 0; // bytes remaining of partly transmitted event at head
+        uint8_t eventPacked = 0; // bytes packed (beyond those queued) of event being packed
+        bool eventPacking = false; // whether an event is being packed
+        bool eventForced = false; // whether event being packed may discard queued events to make room
+        bool eventOverflow = false; // whether event being packed is to be dropped
+        uint16_t eventsDroppedCount = 0; // events dropped (wraps)
+
+        inline uint8_t eventIndex(uint16_t i) // wrap index into ring (helper, not Brief instruction)
+        {
+            return i % EVENT_BUFFER_SIZE;
+        }
+
+        /* Events raised in interrupt context (see `interrupt()`) are instead packed into a small ring of
+        their own; the interrupt being its only producer and `loop()` its only consumer (moving events
+        into the ring above), so that neither updates the other's indices. The main context may well be
+        halfway through transmitting or packing an event when interrupted. An event not fitting is
+        dropped (there being nothing the interrupt may discard). */
+
+        uint8_t isrEvents[ISR_EVENT_BUFFER_SIZE]; // ring of interrupt context events (length, ID, data)
+        volatile uint8_t isrEventHead = 0; // end of committed events (written only by interrupts)
+        volatile uint8_t isrEventTail = 0; // next event to be moved (written only by `loop()`)
+        uint8_t isrEventPacked = 0; // bytes packed (beyond head) of event being packed
+        bool isrEventPacking = false; // whether an event is being packed (in interrupt context)
+        bool isrEventOverflow = false; // whether event being packed is to be dropped
+        volatile uint8_t isrEventsDropped = 0; // interrupt context events dropped (wraps)
+        uint8_t isrEventsCounted = 0; // of those, added to `eventsDroppedCount` already
+        bool isrContext = false; // whether running in interrupt context
+
+        inline uint8_t isrEventIndex(uint16_t i) // wrap index into interrupt ring (helper)
+        {
+            return i % ISR_EVENT_BUFFER_SIZE;
+        }
+
+        void isrEventPut(uint8_t b) // append byte to interrupt context event being packed (helper)
+        {
+            if (!isrEventPacking || isrEventOverflow) return;
+            uint8_t used = isrEventIndex(isrEventHead + ISR_EVENT_BUFFER_SIZE - isrEventTail);
+            if (used + isrEventPacked >= ISR_EVENT_BUFFER_SIZE - 1) // full (head never catching tail)
+            {
+                isrEventOverflow = true;
+                return;
+            }
+            isrEvents[isrEventIndex(isrEventHead + isrEventPacked)] = b;
+            isrEventPacked++;
+        }
+
+        void isrEventCommit() // publish interrupt context event packed (helper)
+        {
+            isrEventPacking = false;
+            if (isrEventOverflow)
+            {
+                isrEventsDropped++;
+                return;
+            }
+            isrEvents[isrEventHead] = isrEventPacked - 2; // data length (excluding ID)
+            isrEventHead = isrEventIndex(isrEventHead + isrEventPacked); // publish
+        }
+
+        void pollISREvents() // move interrupt context events into the event ring (helper)
+        {
+            uint8_t dropped = isrEventsDropped;
+            eventsDroppedCount += (uint8_t)(dropped - isrEventsCounted);
+            isrEventsCounted = dropped;
+            if (eventPacking) return; // not to abandon an event being packed (by a suspended word)
+            while (isrEventTail != isrEventHead)
+            {
+                uint8_t tail = isrEventTail;
+                uint8_t len = isrEvents[tail];
+                uint8_t id = isrEvents[isrEventIndex(tail + 1)];
+                eventBegin(id, id == VM_EVENT_ID);
+                for (uint8_t i = 0; i < len; i++) eventPut(isrEvents[isrEventIndex(tail + 2 + i)]);
+                isrEventTail = isrEventIndex(tail + 2 + len); // release
+                eventCommit();
+            }
+        }
+
+        void transmit() // transmit one queued byte (helper)
+        {
+            if (eventInFlight == 0) eventInFlight = events[eventHead] + 2; // length and ID bytes too
+            transport->write(events[eventHead]);
+            eventHead = eventIndex(eventHead + 1);
+            eventQueued--;
+            eventInFlight--;
+        }
+
+        void drain() // transmit queued events as the serial port has room (helper)
+        {
+            while (eventQueued > 0 && (transportBlocking || transport->availableForWrite() > 0))
+            {
+                transmit();
+            }
+        }
+
+        bool discardOldest() // make room by discarding oldest queued event (helper)
+        {
+            while (eventInFlight > 0) transmit(); // finish partly transmitted event
+            if (eventQueued == 0) return false;
+            uint8_t len = events[eventHead] + 2;
+            eventHead = eventIndex(eventHead + len);
+            eventQueued -= len;
+            eventsDroppedCount++;
+            return true;
+        }
+
+        void eventPut(uint8_t b) // append byte to event being packed (helper)
+        {
+            if (isrContext)
+            {
+                isrEventPut(b);
+                return;
+            }
+            if (!eventPacking || eventOverflow) return;
+            while (eventQueued + eventPacked >= EVENT_BUFFER_SIZE)
+            {
+                if (!((eventForced || EVENT_OVERFLOW == EVENT_DROP_OLDEST) && discardOldest()))
+                {
+                    eventOverflow = true; // doesn't fit
+                    return;
+                }
+            }
+            events[eventIndex(eventHead + eventQueued + eventPacked)] = b;
+            eventPacked++;
+        }
+
+        void eventBegin(uint8_t id, bool forced) // begin packing event (helper)
+        {
+            if (isrContext)
+            {
+                if (isrEventPacking) isrEventsDropped++; // partial event abandoned
+                isrEventPacking = true;
+                isrEventOverflow = false;
+                isrEventPacked = 0;
+                isrEventPut(0); // length (filled in upon commit)
+                isrEventPut(id);
+                return;
+            }
+            if (eventPacking) eventsDroppedCount++; // partial event abandoned
+            eventPacking = true;
+            eventForced = forced;
+            eventOverflow = false;
+            eventPacked = 0;
+            eventPut(0); // length (filled in upon commit)
+            eventPut(id);
+        }
+
+        void eventCommit() // queue packed event (helper)
+        {
+            if (isrContext)
+            {
+                if (isrEventPacking) isrEventCommit();
+                return;
+            }
+            if (!eventPacking) return;
+            eventPacking = false;
+            if (eventOverflow)
+            {
+                eventsDroppedCount++;
+                if (EVENT_OVERFLOW == EVENT_ERROR) error(VM_ERROR_EVENT_OVERFLOW);
+                return;
+            }
+            events[eventIndex(eventHead + eventQueued)] = eventPacked - 2; // data length (excluding ID)
+            eventQueued += eventPacked;
+            drain();
+        }
+
+        void eventHeader() // pack event payload (ID from stack)
+        {
+            eventBegin(pop(), false);
+        }
+
+        void eventBody8() // append byte to packed event payload
+        {
+            eventPut(pop());
+        }
+
+        void eventBody16() // append int16 to packed event payload
+        {
+            int16_t val = pop();
+            eventPut(val >> 8);
+            eventPut(val);
+        }
+
+        void eventFooter() // send packed event
+        {
+            eventCommit();
+        }
+
+        void event(uint8_t id, Cell val) // helper to send simple scaler events
+        {
+            // packed directly (not via the data stack) so that errors may be raised mid-instruction
+            eventBegin(id, id == VM_EVENT_ID);
+            if (val != 0)
+            {
+                if (val < INT8_MIN || val > INT8_MAX)
+                {
+                    if (sizeof(Cell) > 2 && (val < INT16_MIN || val > INT16_MAX))
+                    {
+                        eventPut((int32_t)val >> 24);
+                        eventPut((int32_t)val >> 16);
+                    }
+                    eventPut(val >> 8);
+                }
+                eventPut(val);
+            }
+            eventCommit();
+        }
+
+        void eventsDropped() // push count of dropped events
+        {
+            push((uint16_t)(eventsDroppedCount + (uint8_t)(isrEventsDropped - isrEventsCounted))); // interrupts' too
+        }
+
+        /* At high rates, the length and ID headers of individual events take a good portion of the link.
+        Telemetry may instead be batched. The `setTelemetry` instruction registers a record layout of a
+        number of int16 channels along with thresholds at which to flush frames: a number of bytes and a
+        number of milliseconds since the first record of the frame. Each `telemetry` instruction then
+        takes a record (one value per channel) from the stack and appends it to the frame being batched.
+        Frames are flushed by `flushTelemetry`, upon reaching either threshold, or upon `setTelemetry`.
+        A period of zero milliseconds is no time threshold; frames then being flushed only once full.
+
+        Each frame is sent as a single TELEMETRY_EVENT_ID event. The data begins with the number of
+        channels and the (16-bit, wrapping) milliseconds at which the first record was taken. This is
+        followed by the records; each consisting of the milliseconds since the previous record followed
+        by the channel values. The first record in a frame carries absolute values, while the others
+        carry the difference from the previous record. Values are zig-zag encoded (so that small
+        negative numbers are small) and then varint encoded in 7-bit groups (least significant first,
+        with the high bit set on all but the last byte).
+
+          Frame:  channels, time (2 bytes), record, record, ...
+          Record: time delta (varint), value/delta (varint), ...
+
+        Slowly changing signals then take as little as a byte per channel. Setting zero channels
+        disables telemetry. Records already in the dictionary (an array of int16s, one per channel per
+        record; e.g. acquired samples) may be batched by `telemetryBlock` (addr records -) rather than by
+        fetching each value onto the stack. */
+
+        uint8_t telemetryChannels = 0; // channels per record (0 when disabled)
+        uint8_t telemetryLimit = 0; // bytes at which to flush frame
+        uint16_t telemetryPeriod = 0; // milliseconds since first record at which to flush frame
+        uint32_t telemetryStart = 0; // time of first record in frame
+        uint32_t telemetryTime = 0; // time of previous record
+        int16_t telemetryPrevious[TELEMETRY_CHANNELS]; // previous record (for deltas)
+        uint8_t telemetryFrame[TELEMETRY_FRAME_SIZE]; // frame being batched
+        uint8_t telemetryLength = 0; // bytes batched in frame (0 when empty)
+
+        uint8_t varint(uint8_t* b, uint16_t x) // encode 7 bits per byte, returning length (helper)
+        {
+            uint8_t n = 0;
+            while (x >= 0x80)
+            {
+                b[n++] = x | 0x80;
+                x >>= 7;
+            }
+            b[n++] = x;
+            return n;
+        }
+
+        void flushTelemetry() // send batched telemetry frame
+        {
+            if (telemetryLength == 0) return;
+            eventBegin(TELEMETRY_EVENT_ID, false);
+            for (uint8_t i = 0; i < telemetryLength; i++)
+            {
+                eventPut(telemetryFrame[i]);
+            }
+            eventCommit();
+            telemetryLength = 0;
+        }
+
+        void setTelemetry() // register telemetry record layout and flush thresholds (channels bytes ms)
+        {
+            uint16_t ms = pop();
+            uint8_t bytes = pop();
+            uint8_t channels = pop();
+            flushTelemetry();
+            telemetryChannels = channels < TELEMETRY_CHANNELS ? channels : TELEMETRY_CHANNELS;
+            telemetryLimit = bytes < TELEMETRY_FRAME_SIZE ? bytes : TELEMETRY_FRAME_SIZE;
+            telemetryPeriod = ms;
+        }
+
+        uint8_t encodeTelemetry(const int16_t* record, uint32_t now, uint8_t* b) // record (helper)
+        {
+            uint8_t n = 0;
+            bool first = telemetryLength == 0;
+            if (first) // frame header
+            {
+                b[n++] = telemetryChannels;
+                b[n++] = now >> 8;
+                b[n++] = now;
+            }
+            n += varint(b + n, first ? 0 : now - telemetryTime);
+            for (uint8_t c = 0; c < telemetryChannels; c++)
+            {
+                int16_t x = first ? record[c] : record[c] - telemetryPrevious[c];
+                n += varint(b + n, (uint16_t)(x << 1) ^ (uint16_t)(x >> 15)); // zig-zag
+            }
+            return n;
+        }
+
+        bool telemetryDue(uint32_t now) // frame reached time threshold, if any (helper)
+        {
+            return telemetryLength > 0 && telemetryPeriod != 0 && now - telemetryStart >= telemetryPeriod;
+        }
+
+        void batchTelemetry(const int16_t* record) // append record to frame (helper)
+        {
+            uint32_t now = millis();
+            if (telemetryDue(now)) flushTelemetry();
+
+            uint8_t encoded[3 + 3 + TELEMETRY_CHANNELS * 3]; // header, time and values (max 3 bytes each)
+            uint8_t n = encodeTelemetry(record, now, encoded);
+            if (telemetryLength + n > telemetryLimit && telemetryLength > 0) // doesn't fit
+            {
+                flushTelemetry();
+                n = encodeTelemetry(record, now, encoded); // absolute, with header
+            }
+
+            if (telemetryLength == 0) telemetryStart = now;
+            memcpy(telemetryFrame + telemetryLength, encoded, n);
+            telemetryLength += n;
+            telemetryTime = now;
+            memcpy(telemetryPrevious, record, telemetryChannels * sizeof(int16_t));
+
+            if (telemetryLength >= telemetryLimit) flushTelemetry();
+        }
+
+        void telemetry() // batch telemetry record (one value per channel from stack)
+        {
+            int16_t record[TELEMETRY_CHANNELS];
+            for (int8_t c = telemetryChannels - 1; c >= 0; c--)
+            {
+                record[c] = pop();
+            }
+            if (telemetryChannels != 0) batchTelemetry(record);
+        }
+
+        void telemetryBlock() // batch records from dictionary array (addr records -)
+        {
+            Cell n = pop(), address = pop();
+            if (telemetryChannels == 0 || !span(address, (Wide)n * telemetryChannels, 2)) return;
+            int16_t record[TELEMETRY_CHANNELS];
+            for (const uint8_t* e = memory + address; n > 0; n--)
+            {
+                for (uint8_t c = 0; c < telemetryChannels; c++, e += 2) record[c] = element(e);
+                batchTelemetry(record);
+            }
+        }
+
+        void pollTelemetry() // flush telemetry frame upon reaching time threshold (helper)
+        {
+            if (telemetryDue(millis())) flushTelemetry();
+        }
+
+        /* Several event IDs are used to notify the PC of VM activity and errors. Defined in Brief.h:
+
+          ID                 Value    Meaning
+          0xFF   Reset       None     MCU reset
+          0xFE - VM          0        Return stack underflow
+                             1        Return stack overflow
+                             2        Data stack underflow
+                             3        Data stack overflow
+                             4        Indexed out of memory
+                             5        Invalid code (rejected by verifier)
+                             6        Event overflow (EVENT_ERROR policy)
+          0xFD   Telemetry   Frame    Batched telemetry records (see `telemetry`)
+          0xFC   Loop Stats  5 int16s Loop word timing statistics (see `loopStats`)
+          0xFB   Profile     Chunk    Part of profile dump (see `dumpProfile`)
+          0xFA   Image       Tag      Tag of saved dictionary image (see `imageTag`)
+          0xF9   Ack         Sequence Acknowledgement of sequenced frame (0x80 + expected if negative)
+          0xF8   Trace       Chunk    Part of trace dump (see `dumpTrace`) */
+
+        void error(uint8_t code) // error events
+        {
+            event(VM_EVENT_ID, code);
+        }
+
+        /* Below are the primitive Brief instructions; later bound in setup. All of these functions take no
+        parameters and return nothing. Arguments and return values flow through the stack. */
+
+        void eventOp() // send event up to PC containing top stack value
+        {
+            int8_t id = pop();
+            Cell val = pop();
+            event(id, val);
+        }
+
+        /* Memory `fetch`/`store` instructions. Fetches take an address from the stack and push back the
+        contents of that address (within the dictionary). Stores take a value and an address from the
+        stack and store the value to the address. */
+
+        inline int16_t mem16(int16_t address) // helper (not Brief instruction)
+        {
+            int16_t x = ((int16_t)memget(address)) << 8;
+            return x | memget(address + 1);
+        }
+
+        void fetch8()
+        {
+            *s = memget(*s);
+        }
+
+        void store8()
+        {
+            memset(pop(), (uint8_t)pop());
+        }
+
+        void fetch16()
+        {
+            int16_t a = *s;
+            *s = mem16(a);
+        }
+
+        void store16()
+        {
+            int16_t a = pop(), v = pop();
+            memset(a, v >> 8);
+            memset(a + 1, v);
+        }
+
+        /* Literal values are pushed to the stack by the `lit8`/`lit16` instructions. The values is a
+        parameter to the instruction. Literals (as well as branches below) are one of the few
+        instructions to actually have operands. This is done by consuming the bytes at the current
+        program counter and advancing the counter to skip them for execution. */
+
+        void lit8()
+        {
+            push((int8_t)memget(p++)); // sign extended
+        }
+
+        void lit16()
+        {
+            push(mem16(p++)); p++;
+        }
+
+        /* Binary and unary ALU operations pop one or two values and push back one. These include basic
+        arithmetic, bitwise operations, comparison, etc.
+    
+        The truth value used in Brief is all bits reset (-1) and so the bitwise `and`/`or`/`not` words
+        serve equally well as logical operators. */
+
+        void add()
+        {
+            Cell x = pop();
+            *s = *s + x;
+        }
+
+        void sub()
+        {
+            Cell x = pop();
+            *s = *s - x;
+        }
+
+        void mul()
+        {
+            Cell x = pop();
+            *s = *s * x;
+        }
+
+        void div()
+        {
+            Cell x = pop();
+            *s = *s / x;
+        }
+
+        void mod()
+        {
+            Cell x = pop();
+            *s = *s % x;
+        }
+
+        void andb()
+        {
+            Cell x = pop();
+            *s = *s & x;
+        }
+
+        void orb()
+        {
+            Cell x = pop();
+            *s = *s | x;
+        }
+
+        void xorb()
+        {
+            Cell x = pop();
+            *s = *s ^ x;
+        }
+
+        void shift()
+        {
+            Cell x = pop(); // negative values shift left, positive right
+            if (x < 0) *s = *s << -x;
+            else *s = *s >> x;
+        }
+
+        inline Cell boolval(bool b) // helper (not Brief instruction)
+        {
+            // true is all bits on (works for bitwise and logical operations alike)
+            return b ? -1 : 0;
+        }
+
+        void eq()
+        {
+            Cell x = pop();
+            *s = boolval(*s == x);
+        }
+
+        void neq()
+        {
+            Cell x = pop();
+            *s = boolval(*s != x);
+        }
+
+        void gt()
+        {
+            Cell x = pop();
+            *s = boolval(*s > x);
+        }
+
+        void geq()
+        {
+            Cell x = pop();
+            *s = boolval(*s >= x);
+        }
+
+        void lt()
+        {
+            Cell x = pop();
+            *s = boolval(*s < x);
+        }
+
+        void leq()
+        {
+            Cell x = pop();
+            *s = boolval(*s <= x);
+        }
+
+        void notb()
+        {
+            *s = ~(*s);
+        }
+
+        void neg()
+        {
+            *s = -(*s);
+        }
+
+        void inc()
+        {
+            *s = *s + 1;
+        }
+
+        void dec()
+        {
+            *s = *s - 1;
+        }
+
+        /* Control loops (PID and the like) need more than single-cell arithmetic; a product of two
+        cells overflows long before the following shift or divide brings it back into range. The
+        following compute with a double-width intermediate (`Wide`; 32-bit with 16-bit cells) and
+        saturate the result to the cell range rather than wrapping:
+
+          mulDiv   a b c - a*b/c        (truncated, saturating upon division by zero)
+          mulQ8    a b   - a*b >> 8     (Q8.8 fixed point, rounded)
+          mulQ15   a b   - a*b >> 15    (Q1.15 fixed point, rounded)
+          addSat   a b   - a+b
+          subSat   a b   - a-b
+          clamp    x lo hi - x          (limited to lo..hi) */
+
+        typedef typename Wider<Cell>::type Wide; // double-width intermediate
+
+        template <typename T>
+        static inline Cell saturated(T x) // clamp to cell range (helper)
+        {
+            const T max = ((T)1 << (sizeof(Cell) * 8 - 1)) - 1;
+            return x > max ? max : x < -max - 1 ? -max - 1 : x;
+        }
+
+        inline Cell mulDivBy(Wide ab, Cell c) // helper (not Brief instruction)
+        {
+            const Wide beyond = (Wide)1 << (sizeof(Cell) * 8); // outside of cell range
+            if (c == 0) return saturated(ab < 0 ? -beyond : ab > 0 ? beyond : 0); // saturate by sign
+            return saturated(ab / c);
+        }
+
+        void mulDiv()
+        {
+            Cell c = pop(), b = pop();
+            *s = mulDivBy((Wide)*s * b, c);
+        }
+
+        void mulQ8()
+        {
+            Cell x = pop();
+            *s = saturated(((Wide)*s * x + 0x80) >> 8);
+        }
+
+        void mulQ15()
+        {
+            Cell x = pop();
+            *s = saturated(((Wide)*s * x + 0x4000) >> 15);
+        }
+
+        void addSat()
+        {
+            Cell x = pop();
+            *s = saturated((Wide)*s + x);
+        }
+
+        void subSat()
+        {
+            Cell x = pop();
+            *s = saturated((Wide)*s - x);
+        }
+
+        void clamp()
+        {
+            Cell hi = pop(), lo = pop();
+            *s = *s < lo ? lo : *s > hi ? hi : *s;
+        }
+
+        /* Working through an array one `fetch16`/`store16` at a time costs a bounds-checked
+        fetch (or store) per byte and a handful of dispatches per element. The following work on whole
+        ranges of the dictionary instead; the range being checked once per call (raising an out of
+        memory error and doing nothing if it doesn't fit). Arrays and rings are of 16-bit elements,
+        big-endian as with `fetch16`/`store16`, whatever the cell size. Counts are in bytes for `fill`
+        and `move`, otherwise in elements:
+
+          fill         val addr n       -               (bytes set to val)
+          move         src dst n        -               (bytes copied; ranges may overlap)
+          vectorSum    addr n           - sum
+          vectorMinMax addr n           - min max       (0 0 if empty)
+          vectorDot    a b n            - sum           (sum of products)
+          vectorAdd    a b dst n        -               (dst[i] = a[i]+b[i], saturating)
+          vectorScale  a k dst n        -               (dst[i] = a[i]*k >> 8, k being Q8.8, rounded)
+          average      x ring n         - mean          (moving average)
+          fir          x ring taps n    - y             (FIR filter, taps being Q1.15, rounded)
+
+        A ring is an index cell followed by n elements; zeroed memory being an empty ring. Both
+        `average` and `fir` add the sample x to the ring (replacing the oldest) and then compute over
+        the whole of it. The taps of `fir` are ordered from the oldest sample to the newest (no
+        matter for the usual symmetric filters). Sums saturate to the cell range. */
+
+        inline bool span(Cell address, Wide count, uint8_t width) // range within dictionary (helper)
+        {
+            if (address < 0 || count < 0 || (Wide)address + count * width > MemSize)
+            {
+                error(VM_ERROR_OUT_OF_MEMORY);
+                return false;
+            }
+
+            return true;
+        }
+
+        static inline int16_t element(const uint8_t* e) // helper (not Brief instruction)
+        {
+            return (int16_t)(e[0] << 8 | e[1]);
+        }
+
+        static inline void setElement(uint8_t* e, int32_t x) // saturating to 16-bit (helper)
+        {
+            int16_t y = x > 0x7FFF ? 0x7FFF : x < -0x8000 ? -0x8000 : x;
+            e[0] = y >> 8;
+            e[1] = y;
+        }
+
+        static int64_t dotOf(const uint8_t* a, const uint8_t* b, uint16_t n) // helper
+        {
+            int64_t sum = 0;
+#if defined(__ARM_FEATURE_DSP) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            // Cortex-M4/M7 (e.g. Teensy): byte swap pairs of elements into halfwords and
+            // multiply-accumulate both at once
+            uint32_t lo = 0, hi = 0;
+            for (; n >= 2; n -= 2, a += 4, b += 4)
+            {
+                uint32_t x, y;
+                ::memcpy(&x, a, 4);
+                ::memcpy(&y, b, 4);
+                asm ("rev16 %0, %0" : "+r" (x));
+                asm ("rev16 %0, %0" : "+r" (y));
+                asm ("smlald %0, %1, %2, %3" : "+r" (lo), "+r" (hi) : "r" (x), "r" (y));
+            }
+            sum = (int64_t)((uint64_t)hi << 32 | lo);
+#endif
+            for (; n > 0; n--, a += 2, b += 2) sum += (int32_t)element(a) * element(b);
+            return sum;
+        }
+
+        uint8_t* ring(Cell x, Cell address, Cell n) // add sample, giving oldest index (helper)
+        {
+            if (n < 1 || !span(address, n + 1, 2)) return 0;
+            uint8_t* r = memory + address;
+            int16_t i = element(r);
+            if (i < 0 || i >= n) i = 0; // corrupt index (restart)
+            setElement(r + 2 + i * 2, x);
+            i = i + 1 < n ? i + 1 : 0;
+            setElement(r, i);
+            return r;
+        }
+
+        void fill()
+        {
+            Cell n = pop(), address = pop();
+            uint8_t val = pop();
+            if (span(address, n, 1)) ::memset(memory + address, val, n);
+        }
+
+        void move()
+        {
+            Cell n = pop(), dst = pop(), src = pop();
+            if (span(src, n, 1) && span(dst, n, 1)) ::memmove(memory + dst, memory + src, n);
+        }
+
+        void vectorSum()
+        {
+            Cell n = pop();
+            int32_t sum = 0;
+            if (span(*s, n, 2))
+            {
+                for (const uint8_t* e = memory + *s; n > 0; n--, e += 2) sum += element(e);
+            }
+
+            *s = saturated((int64_t)sum);
+        }
+
+        void vectorMinMax()
+        {
+            Cell n = pop();
+            int16_t lo = 0, hi = 0;
+            if (n > 0 && span(*s, n, 2))
+            {
+                const uint8_t* e = memory + *s;
+                lo = hi = element(e);
+                for (e += 2, n--; n > 0; n--, e += 2)
+                {
+                    int16_t x = element(e);
+                    if (x < lo) lo = x;
+                    if (x > hi) hi = x;
+                }
+            }
+
+            *s = lo;
+            push(hi);
+        }
+
+        void vectorDot()
+        {
+            Cell n = pop(), b = pop();
+            int64_t sum = span(*s, n, 2) && span(b, n, 2) ? dotOf(memory + *s, memory + b, n) : 0;
+            *s = saturated(sum);
+        }
+
+        void vectorAdd()
+        {
+            Cell n = pop(), dst = pop(), b = pop(), a = pop();
+            if (span(a, n, 2) && span(b, n, 2) && span(dst, n, 2))
+            {
+                for (uint8_t *x = memory + a, *y = memory + b, *z = memory + dst; n > 0; n--, x += 2, y += 2, z += 2)
+                {
+                    setElement(z, (int32_t)element(x) + element(y));
+                }
+            }
+        }
+
+        void vectorScale()
+        {
+            Cell n = pop(), dst = pop(), k = pop(), a = pop();
+            if (span(a, n, 2) && span(dst, n, 2))
+            {
+                for (uint8_t *x = memory + a, *z = memory + dst; n > 0; n--, x += 2, z += 2)
+                {
+                    Wide y = ((Wide)element(x) * k + 0x80) >> 8;
+                    setElement(z, y > 0x7FFF ? 0x7FFF : y < -0x8000 ? -0x8000 : y);
+                }
+            }
+        }
+
+        void average()
+        {
+            Cell n = pop(), address = pop();
+            uint8_t* r = ring(*s, address, n);
+            int32_t sum = 0;
+            if (r != 0)
+            {
+                for (const uint8_t* e = r + 2; e < r + 2 + n * 2; e += 2) sum += element(e);
+                sum /= n;
+            }
+
+            *s = sum;
+        }
+
+        void fir()
+        {
+            Cell n = pop(), taps = pop(), address = pop();
+            uint8_t* r = span(taps, n, 2) ? ring(*s, address, n) : 0;
+            int64_t y = 0;
+            if (r != 0)
+            {
+                uint16_t oldest = element(r), older = n - oldest; // samples from oldest to end of ring
+                const uint8_t *samples = r + 2, *t = memory + taps;
+                y = (dotOf(samples + oldest * 2, t, older) + dotOf(samples, t + older * 2, oldest) + 0x4000) >> 15;
+            }
+
+            *s = saturated(y);
+        }
+
+        /* Stack manipulation instructions */
+
+        void drop()
+        {
+            s--;
+        }
+
+        void dup()
+        {
+            push(*s);
+        }
+
+        void swap()
+        {
+            Cell t = *s;
+            Cell* n = s - 1;
+            *s = *n; *n = t;
+        }
+
+        void pick() // nth item to top of stack
+        {
+            int16_t n = pop();
+            push(*(s - n));
+        }
+
+        void roll() // top item slipped into nth position
+        {
+            int16_t n = pop();
+            Cell t = *(s - n);
+            Cell* i;
+            for (i = s - n; i < s; i++)
+            {
+                *i = *(i + 1);
+            }
+            *s = t;
+        }
+
+        void clr() // clear stack
+        {
+            s = dstack;
+        }
+
+        /* Moving items between data and return stack. The return stack is commonly also used to store data
+        that is local to a subroutine. It is safe to push data here to be recovered after a subroutine
+        call. It is not safe to use it for passing data between subroutines. That is what the data stack
+        is for. Think of arguments vs. locals. The normal way of handling locals in Brief that need to
+        survive a call and return from another word is to store them on the return stack. */
+
+        void pushr()
+        {
+            rpush(pop());
+        }
+
+        void popr()
+        {
+            push(rpop());
+        }
+
+        void peekr()
+        {
+            push(*r);
+        }
+
+        /* Dictionary manipulation instructions:
+
+        The `forget` function is a Forthism for reverting to the address of a previously defined word;
+        essentially forgetting it and any (potentially dependent words) defined thereafter. */
+
+        void forget() // revert dictionary pointer to TOS
+        {
+            int16_t i = pop();
+            if (i < here) here = i; // don't "remember" random memory!
+            unverify(here);
+        }
+
+        /* A `call` instruction pops an address and calls it; pushing the current `p` as to return. */
+
+        void call()
+        {
+            rpush(p);
+            p = pop();
+        }
+
+        /* Quotations and `choice` need some explanation. The idea behind quotations is something like
+        an anonymous lambda and is used with some nice syntax in the Brief language. The `quote`
+        instruction precedes a sequence that is to be treated as an embedded definition
+        essentially. It takes a length as an operand, pushes the address of the sequence of code
+        following and then jumps over that code.
+
+        The net result is that the sequence is not executed, but its address is left on the stack
+        for future words to call as they see fit.
+
+        One primitive that makes use of this is `choice` which is the idiomatic Brief conditional.
+        It pops two addresses (likely from two quotations) along with a predicate value (likely the
+        result of some comparison or logical operations). It then executes one or the other
+        quotation depending on the predicate.
+
+        Another primitive making use of quotations is `chooseIf` (called simply `if` in Brief) which
+        pops a predicate and a single address; calling the address if non-zero.
+
+        Many secondary words in Brief also use quotation such as `bi`, `tri`, `map`, `fold`, etc.
+        which act as higher-order functions.
+
+        When the quotations given to `choice` or `if` are literal, the compiler instead lays their code
+        out inline and jumps around it with `zbranch` (pop and branch if zero) and `branch`. These take
+        a signed 8-bit offset operand relative to the following instruction. This saves the `quote`,
+        the call and the return (and the return stack slot). */
+
+        void quote()
+        {
+            uint8_t len = memget(p++);
+            push(p); // address of quotation
+            p += len; // jump over
+        }
+
+        void choice()
+        {
+            int16_t f = pop(), t = pop();
+            rpush(p);
+            p = pop() == 0 ? f : t;
+        }
+
+        void chooseIf()
+        {
+            int16_t t = pop();
+            if (pop() != 0)
+            {
+                rpush(p);
+                p = t;
+            }
+        }
+
+        void zbranch()
+        {
+            int8_t rel = memget(p++);
+            if (pop() == 0) p += rel;
+        }
+
+        void branch()
+        {
+            int8_t rel = memget(p++);
+            p += rel;
+        }
+
+        void next()
+        {
+            Cell count = rpop() - 1;
+            int16_t rel = memget(p++);
+            if (count > 0)
+            {
+                rpush(count);
+                p -= (rel + 2);
+            }
+        }
+
+        void nop()
+        {
+        }
+
+        void extension() // call through extended instruction table (index operand)
+        {
+            uint8_t i = memget(p++);
+            if (i < MAX_EXTENSIONS && extensions[i] != 0) extensions[i]();
+            else error(VM_ERROR_INVALID_CODE); // unbound
+        }
+
+        /* A Brief word (address) may be set to run in the main loop. Also, a loop counter is
+        maintained for use by conditional logic (throttling for example). */
+
+        int16_t loopword = -1; // address of loop word
+
+        int16_t loopIterations = 0; // number of iterations since 'setup' (wraps)
+
+        void loopTicks()
+        {
+            push(loopIterations & 0x7FFF);
+        }
+
+        /* The loop word normally runs upon every pass of `loop()`; as often as ingest and the word itself
+        allow. Given a period by `setLoopPeriod` (in microseconds, up to 65535) it instead runs upon a
+        `micros()` deadline. A run less than a period late is caught up by advancing the deadline by exactly
+        one period, keeping phase. Later than that, the missed runs are skipped and counted as overruns. A
+        period of zero returns to free running.
+
+        In either mode, timing statistics are gathered: the min, max and mean execution time of the loop
+        word, the period jitter (max less min interval between the start of runs) and the number of
+        overruns; all in (saturated 16-bit) microseconds. These are pushed in that order by `loopStats`, or
+        sent by `loopStatsEvent` as a LOOP_STATS_EVENT_ID event of the five as int16s. The statistics are
+        cleared by `resetLoopStats`, `setLoop` and `setLoopPeriod`. A run suspended (with BUDGET) is
+        counted, and its parts timed together, only once it completes (`loopTicks` too). */
+
+        uint16_t loopPeriod = 0; // microseconds between runs of loop word (0 = free running)
+        uint32_t loopDue; // micros() at which loop word is next due
+        uint32_t loopStart; // micros() at which loop word last started
+        uint32_t loopTotal; // sum of execution times (for mean)
+        uint16_t loopRuns; // runs counted in loopTotal
+        uint16_t loopExecMin, loopExecMax; // execution time extremes
+        uint16_t loopIntervalMin, loopIntervalMax; // interval extremes
+        uint16_t loopOverruns; // runs skipped
+        uint32_t loopSpent; // execution time so far of suspended run (BUDGET)
+
+        inline uint16_t saturate(uint32_t x) // clamp to 16-bit (helper)
+        {
+            return x > UINT16_MAX ? UINT16_MAX : x;
+        }
+
+        void resetLoopStats()
+        {
+            loopTotal = loopRuns = loopOverruns = 0;
+            loopExecMin = loopIntervalMin = UINT16_MAX;
+            loopExecMax = loopIntervalMax = 0;
+        }
+
+        void loopStatValues(uint16_t* v) // min max mean jitter overruns (helper)
+        {
+            v[0] = loopRuns > 0 ? loopExecMin : 0;
+            v[1] = loopExecMax;
+            v[2] = loopRuns > 0 ? loopTotal / loopRuns : 0;
+            v[3] = loopIntervalMax >= loopIntervalMin ? loopIntervalMax - loopIntervalMin : 0;
+            v[4] = loopOverruns;
+        }
+
+        void loopStats() // - min max mean jitter overruns
+        {
+            uint16_t v[5];
+            loopStatValues(v);
+            for (uint8_t i = 0; i < 5; i++) push(v[i]);
+        }
+
+        void loopStatsEvent()
+        {
+            uint16_t v[5];
+            loopStatValues(v);
+            eventBegin(LOOP_STATS_EVENT_ID, false);
+            for (uint8_t i = 0; i < 5; i++)
+            {
+                eventPut(v[i] >> 8);
+                eventPut(v[i]);
+            }
+            eventCommit();
+        }
+
+        /* The profile (see PROFILE above) is cleared by `resetProfile` and sent by `dumpProfile` as a
+        series of PROFILE_EVENT_ID events, each beginning with a kind byte. Kind 0 is followed by opcode
+        records (opcode byte, int16 count) for those executed, kind 1 by word records (int16 address, int16
+        calls, int32 time) and a final kind 2 event (alone) marks the end of the dump. Being larger than the
+        event ring, the dump is sent an event at a time by `loop()` as the ring empties. Without PROFILE,
+        only the end marker is sent. */
+
+#if PROFILE
+#define PROFILE_OPS_PER_EVENT   ((EVENT_BUFFER_SIZE - 3) / 3) // opcode records fitting an event
+#define PROFILE_WORDS_PER_EVENT ((EVENT_BUFFER_SIZE - 3) / 8) // word records fitting an event
+#endif
+
+        int16_t profileCursor = -1; // next opcode (then word slot) to be sent (-1 when not dumping)
+
+        void resetProfile()
+        {
+#if PROFILE
+            for (uint8_t i = 0; i < MAX_PRIMITIVES; i++) profileOps[i] = 0;
+            for (uint8_t i = 0; i < PROFILED_WORDS; i++)
+            {
+                profileAddresses[i] = -1;
+                profileCalls[i] = 0;
+                profileTimes[i] = 0;
+            }
+#endif
+        }
+
+        void dumpProfile()
+        {
+#if PROFILE
+            profileCursor = 0;
+#else
+            profileCursor = MAX_PRIMITIVES + PROFILED_WORDS; // end marker only
+#endif
+        }
+
+        void pollProfile() // send next event of profile dump once ring is empty (helper)
+        {
+            if (profileCursor < 0 || eventQueued != 0) return;
+            eventBegin(PROFILE_EVENT_ID, false);
+#if PROFILE
+            if (profileCursor < MAX_PRIMITIVES) // opcodes
+            {
+                eventPut(0);
+                for (uint8_t n = 0; profileCursor < MAX_PRIMITIVES && n < PROFILE_OPS_PER_EVENT; profileCursor++)
+                {
+                    uint16_t count = profileOps[profileCursor];
+                    if (count == 0) continue; // not executed
+                    eventPut(profileCursor);
+                    eventPut(count >> 8);
+                    eventPut(count);
+                    n++;
+                }
+            }
+            else if (profileCursor < MAX_PRIMITIVES + PROFILED_WORDS) // words
+            {
+                eventPut(1);
+                for (uint8_t n = 0; n < PROFILE_WORDS_PER_EVENT; n++)
+                {
+                    uint8_t i = profileCursor - MAX_PRIMITIVES;
+                    if (i >= PROFILED_WORDS || profileAddresses[i] == -1) // no more
+                    {
+                        profileCursor = MAX_PRIMITIVES + PROFILED_WORDS;
+                        break;
+                    }
+                    eventPut(profileAddresses[i] >> 8);
+                    eventPut(profileAddresses[i]);
+                    eventPut(profileCalls[i] >> 8);
+                    eventPut(profileCalls[i]);
+                    for (int8_t b = 24; b >= 0; b -= 8) eventPut(profileTimes[i] >> b);
+                    profileCursor++;
+                }
+            }
+            else
+#endif
+            {
+                eventPut(2); // end
+                profileCursor = -1;
+            }
+            eventCommit();
+        }
+
+        /* The trace (see TRACE above) is cleared and recording begun anew by `resetTrace`. It is frozen by
+        `dumpTrace` and sent as a series of TRACE_EVENT_ID events, each beginning with a kind byte. Kind 0 is
+        followed by records (int16 address, opcode byte, int16 top of stack) oldest first, kind 1 by the same
+        along with an int16 time since the previous and a final kind 2 event (alone) marks the end of the
+        dump. As with the profile, the dump is sent an event at a time by `loop()` as the ring empties. The
+        ring remains frozen (dumping it again sends the same records) until reset. Without TRACE, only the end
+        marker is sent. */
+
+#if TRACE
+#if TRACE_TIME
+#define TRACE_RECORD_SIZE 7
+#else
+#define TRACE_RECORD_SIZE 5
+#endif
+#define TRACE_RECORDS_PER_EVENT ((EVENT_BUFFER_SIZE - 3) / TRACE_RECORD_SIZE) // records fitting an event
+#endif
+
+        int16_t traceCursor = -1; // next record to be sent, oldest first (-1 when not dumping)
+
+        void resetTrace()
+        {
+#if TRACE
+            traceNext = traceLength = 0;
+            traceFrozen = false;
+#if TRACE_TIME
+            traceTime = TRACE_CLOCK();
+#endif
+#endif
+        }
+
+        void dumpTrace()
+        {
+#if TRACE
+            traceFrozen = true;
+#endif
+            traceCursor = 0; // (end marker only without TRACE)
+        }
+
+        void pollTrace() // send next event of trace dump once ring is empty (helper)
+        {
+            if (traceCursor < 0 || eventQueued != 0) return;
+            eventBegin(TRACE_EVENT_ID, false);
+#if TRACE
+            if (traceCursor < traceLength)
+            {
+                eventPut(TRACE_TIME ? 1 : 0);
+                uint16_t oldest = traceNext - traceLength;
+                for (uint8_t n = 0; traceCursor < traceLength && n < TRACE_RECORDS_PER_EVENT; n++, traceCursor++)
+                {
+                    const Trace& t = traceRing[(oldest + traceCursor) & (TRACE_DEPTH - 1)];
+                    eventPut(t.address >> 8);
+                    eventPut(t.address);
+                    eventPut(t.opcode);
+                    eventPut(t.tos >> 8);
+                    eventPut(t.tos);
+#if TRACE_TIME
+                    eventPut(t.delta >> 8);
+                    eventPut(t.delta);
+#endif
+                }
+            }
+            else
+#endif
+            {
+                eventPut(2); // end
+                traceCursor = -1;
+            }
+            eventCommit();
+        }
+
+        void setLoop()
+        {
+#if BUDGET
+            loopResume = -1; // abandon suspended loop word
+#endif
+            loopIterations = 0;
+            loopword = pop();
+            loopDue = micros();
+            resetLoopStats();
+        }
+
+        void setLoopPeriod() // microseconds -
+        {
+            loopPeriod = pop();
+            loopDue = micros();
+            resetLoopStats();
+        }
+
+        void stopLoop()
+        {
+#if BUDGET
+            loopResume = -1; // abandon suspended loop word
+#endif
+            loopword = -1;
+        }
+
+        void runLoop() // run loop word if due, gathering statistics (helper)
+        {
+            uint32_t now = micros();
+            if (loopPeriod != 0)
+            {
+                int32_t late = now - loopDue;
+                if (late < 0) return; // not yet due
+                if (late >= loopPeriod) // overrun
+                {
+                    uint32_t missed = late / loopPeriod;
+                    loopOverruns = saturate((uint32_t)loopOverruns + missed);
+                    loopDue += missed * loopPeriod; // skip missed runs, keeping phase
+                }
+                loopDue += loopPeriod;
+            }
+
+            if (loopRuns > 0)
+            {
+                uint16_t interval = saturate(now - loopStart);
+                if (interval < loopIntervalMin) loopIntervalMin = interval;
+                if (interval > loopIntervalMax) loopIntervalMax = interval;
+            }
+            loopStart = now;
+
+#if BUDGET
+            slice();
+#endif
+            exec(loopword);
+            uint32_t t = micros() - now;
+#if BUDGET
+            if (loopResume >= 0) // suspended (counted upon completion)
+            {
+                loopSpent = t;
+                return;
+            }
+#endif
+            loopRan(t);
+        }
+
+        void loopRan(uint32_t time) // count completed run of loop word, gathering statistics (helper)
+        {
+            loopIterations++;
+            uint16_t t = saturate(time);
+            if (t < loopExecMin) loopExecMin = t;
+            if (t > loopExecMax) loopExecMax = t;
+            loopTotal += t;
+            if (++loopRuns == UINT16_MAX) // halve rather than overflow (mean unchanged)
+            {
+                loopRuns >>= 1;
+                loopTotal >>= 1;
+            }
+        }
+
+        /* In addition to the loop word, a few words may run as cooperative tasks; each in a slot with its
+        own (small) data and return stack and program counter. Slots are visited in priority order (slot
+        zero first) after the loop word, upon each pass of `loop()`. A task is run when due (every `period`
+        milliseconds up to 32767, or every pass given zero) until it returns, to be started afresh once
+        next due, or until it executes `yield`. A yielded task is suspended where it left off and resumed
+        upon the following pass, letting long-running work be split into slices without hand-multiplexing
+        by `loopTicks`. A task's data stack persists across runs, as does the main stack across loop words.
+
+        Only occupied slots are visited; with none, the scheduler costs a single test per pass. Each slot
+        takes (TASK_DATA_STACK_SIZE + TASK_RETURN_STACK_SIZE + 2) * sizeof(Cell) + 2 * sizeof(Cell*) + 8
+        bytes of RAM (32 by default on AVR; 56 with 32-bit cells and pointers). */
+
+        int16_t taskWords[MAX_TASKS]; // address of task word
+        int16_t taskResume[MAX_TASKS]; // address at which yielded task resumes (-1 if not suspended)
+        Cell* taskS[MAX_TASKS]; // saved data stack pointer
+        Cell* taskR[MAX_TASKS]; // saved return stack pointer (while suspended)
+        uint16_t taskPeriod[MAX_TASKS]; // milliseconds between runs
+        uint16_t taskDue[MAX_TASKS]; // (16-bit, wrapping) milliseconds at which next run is due
+        Cell taskData[MAX_TASKS][TASK_DATA_STACK_SIZE + 1]; // per-task eval stacks ([0] unused)
+        Cell taskReturn[MAX_TASKS][TASK_RETURN_STACK_SIZE + 1]; // per-task return stacks ([0] unused)
+        uint8_t tasks = 0; // bit per occupied slot
+        int8_t task = -1; // slot of running task (-1 if none)
+
+        void setTask() // word period priority -
+        {
+            uint8_t i = pop();
+            uint16_t period = pop();
+            int16_t w = pop();
+            if (i >= MAX_TASKS)
+            {
+                error(VM_ERROR_OUT_OF_MEMORY); // indexed beyond task table
+                return;
+            }
+            taskWords[i] = w;
+            taskResume[i] = -1;
+            taskS[i] = taskData[i];
+            taskPeriod[i] = period;
+            taskDue[i] = millis();
+            tasks |= 1 << i;
+        }
+
+        void stopTask() // priority -
+        {
+            uint8_t i = pop();
+            if (i < MAX_TASKS) tasks &= ~(1 << i);
+        }
+
+        void yieldTask() // suspend running task until next pass of `loop()` (ignored outside of tasks, but for loop word given BUDGET)
+        {
+#if BUDGET
+            if (preempt) suspend(); // loop word as well
+#else
+            if (task < 0) return;
+            taskResume[task] = p;
+            p = -1; // causing `run()` to fall through
+#endif
+        }
+
+        void runTasks() // run occupied slots when due or suspended (helper)
+        {
+            Cell *ds = dstack, *dl = dlimit, *ss = s, *rs = rstack, *rl = rlimit, *rr = r;
+            uint16_t now = millis();
+            for (uint8_t i = 0; i < MAX_TASKS; i++)
+            {
+                if ((tasks & (1 << i)) == 0) continue; // free slot
+                int16_t resume = taskResume[i];
+                if (resume < 0 && (int16_t)(now - taskDue[i]) < 0) continue; // not yet due
+
+                // switch to task context
+                task = i;
+                dstack = taskData[i];
+                dlimit = taskData[i] + TASK_DATA_STACK_SIZE;
+                s = taskS[i];
+                rstack = taskReturn[i];
+                rlimit = taskReturn[i] + TASK_RETURN_STACK_SIZE;
+
+#if BUDGET
+                slice();
+#endif
+                if (resume >= 0) // suspended
+                {
+                    taskResume[i] = -1;
+                    r = taskR[i];
+                    p = resume;
+                    run();
+                }
+                else
+                {
+                    taskDue[i] += taskPeriod[i];
+                    if ((int16_t)(now - taskDue[i]) >= 0) taskDue[i] = now + taskPeriod[i]; // fell behind
+                    exec(taskWords[i]);
+                }
+
+                taskS[i] = s;
+                taskR[i] = r;
+            }
+
+            // restore main context
+            task = -1;
+            dstack = ds; dlimit = dl; s = ss; rstack = rs; rlimit = rl; r = rr;
+        }
+
+#if BUDGET
+        /* Given a budget, each run of the loop word or of a task is cut short once it has executed the
+        given number of instructions or taken the given number of microseconds (either zero for no
+        limit), and is suspended. A task is suspended as if it had said `yield`. The loop word keeps its
+        place, and its return stack is set aside by moving up the base of the main return stack, until
+        the next pass of `loop()` resumes it (rather than starting it afresh) after serial input and
+        events have been serviced. Immediate code received meanwhile runs atop the suspended word; it
+        shares the data stack, so it should leave the stack as found. Being stored only temporarily, it
+        is never itself suspended, nor are interrupt words. `yield` suspends the loop word too.
+
+        `stopLoop`, `setLoop`, `restore` and `resetBoard` abandon a suspended loop word. A primitive
+        (e.g. a custom `delay`) isn't interrupted; the budget is checked between instructions. */
+
+        uint16_t budgetInstructions = 0; // instructions per run (0 for no limit)
+        uint16_t budgetMicros = BUDGET_MICROS; // microseconds per run (0 for no limit)
+        uint16_t budgetLeft = 0; // instructions left in current run (0 for no limit)
+        uint16_t countdown = 1; // instructions until next check of budget
+        uint16_t chunk = UINT16_MAX; // instructions between checks of budget
+        uint32_t budgetStart; // microseconds at start of current run
+        bool preempt = false; // whether current run may be suspended
+        int16_t loopResume = -1; // address at which suspended loop word resumes (-1 if not suspended)
+
+        void budget() // instructions microseconds -
+        {
+            budgetMicros = pop();
+            budgetInstructions = pop();
+        }
+
+        void rewind() // count down to next check of budget (helper)
+        {
+            chunk = budgetMicros != 0 ? BUDGET_CHECK : UINT16_MAX;
+            if (budgetLeft != 0 && budgetLeft < chunk) chunk = budgetLeft;
+            countdown = chunk;
+        }
+
+        void slice() // begin budgeted run (helper)
+        {
+            budgetStart = micros();
+            budgetLeft = budgetInstructions;
+            rewind();
+            countdown++; // counted upon entry
+        }
+
+        bool spent() // whether out of budget, upon countdown expiring (helper)
+        {
+            bool out = false;
+            if (preempt)
+            {
+                if (budgetLeft != 0 && (budgetLeft -= chunk) == 0) out = true;
+                else if (budgetMicros != 0 && micros() - budgetStart >= budgetMicros) out = true;
+            }
+            rewind();
+            return out;
+        }
+
+        void suspend() // suspend run until next pass of `loop()` (helper)
+        {
+            if (task >= 0)
+            {
+                taskResume[task] = p;
+            }
+            else // loop word
+            {
+                loopResume = p;
+                rstack = r; // set aside return stack
+            }
+            p = -1; // causing `run()` to fall through
+        }
+
+        bool resume() // resume suspended loop word; whether resumed (helper)
+        {
+            if (rstack == rmain) return false; // not suspended
+            r = rstack;
+            rstack = rmain;
+            if (loopResume < 0) return false; // abandoned
+            p = loopResume;
+            loopResume = -1;
+            uint32_t start = micros();
+            slice();
+            run();
+            uint32_t t = loopSpent + (micros() - start);
+            if (loopResume >= 0) loopSpent = t; // suspended again
+            else loopRan(t);
+            return true;
+        }
+#endif
+
+        /* Upon first connecting to a board, the PC will execute a reset so that assumptions about
+        dictionary contents and such hold true. */ 
+
+        void stopRuntime() // end activity of the code running: tasks, acquisition, watches, ... (helper)
+        {
+#if BUDGET
+            loopResume = -1; // abandon suspended loop word
+#endif
+            tasks = 0;
+            acquireChannels = 0;
+            pinHandleCount = 0;
+            watchCount = 0;
+            flushTelemetry(); // records batched so far
+            telemetryChannels = 0;
+            isrQueueTail = isrQueueHead; // drop deferred interrupt words pending
+        }
+
+        void resetBoard() // likely called initialy upon connecting from PC
+        {
+            clr();
+            stopRuntime();
+            here = last = 0;
+            unverify(0);
+            loopword = -1;
+            loopIterations = 0;
+            loopPeriod = 0;
+#if BUDGET
+            budgetInstructions = 0;
+            budgetMicros = BUDGET_MICROS;
+#endif
+            for (uint8_t i = 0; i < CALL_VECTORS; i++) vectors[i] = -1;
+            resetProfile();
+            resetTrace();
+        }
+
+        /* Here begins all of the Arduino-specific instructions.
+
+        Starting with basic setup and reading/write to GPIO pins. Note we treat `HIGH`/`LOW` values as
+        Brief-style booleans (-1 or 0) to play well with the logical and conditional operations. */
+
+        void pinMode()
+        {
+            ::pinMode(pop(), pop());
+        }
+
+        void digitalRead()
+        {
+            push(::digitalRead(pop()) ? -1 : 0);
+        }
+
+        void digitalWrite()
+        {
+            ::digitalWrite(pop(), pop() == 0 ? LOW : HIGH);
+        }
+
+        /* Each `digitalRead`/`digitalWrite` looks up the pin's port and bit through the Arduino core; a
+        few microseconds on AVR, limiting bit-banged protocols to a fraction of what the hardware can do.
+        Instead, `pinHandle` (pin - handle) resolves the pin's port registers and bit mask once, giving a
+        small handle by which later accesses are single register operations:
+
+          pinHandle  pin            - handle
+          pinWrite   bool handle    -
+          pinRead    handle         - bool
+          pinToggle  handle         -
+          portRead   handle         - bits    (input register of the pin's port)
+          portWrite  bits mask handle -       (masked bits of the pin's port output register)
+
+        Whole ports allow several pins to be updated at once; e.g. a parallel bus. The pin mode is still
+        set by `pinMode`. Resolving the same pin again gives the same handle and up to MAX_PIN_HANDLES are
+        kept (until reset). Read-modify-write of a port register is done with interrupts masked (and
+        restored; handles being usable from ISR words too). Where the core has no port registers
+        (PORT_IO is 0) handles fall back to `digitalRead`/`digitalWrite` and a "port" is the single pin
+        (bit 0). Where the port is wider than a cell (32-bit SAMD ports with 16-bit cells) `portRead` and
+        `portWrite` see only the cell-wide half of the port holding the handle's pin; bits relative to
+        that half. */
+
+#if PORT_IO == 8
+        typedef uint8_t PortBits;
+#else
+        typedef uint32_t PortBits;
+#endif
+
+#if PORT_IO
+        static const uint8_t portHalf = sizeof(Cell) < sizeof(PortBits) ? sizeof(Cell) * 8 : 0; // bits of cell-wide part
+        static const PortBits cellBits = portHalf ? ((PortBits)1 << portHalf) - 1 : (PortBits)~0; // port bits in a cell
+#endif
+
+        struct PinHandle
+        {
+#if PORT_IO
+            volatile PortBits* out; // output register
+            volatile PortBits* in; // input register
+            PortBits mask; // bit within port
+            uint8_t shift; // of the cell-wide part of the port holding the pin (0 unless port wider)
+#endif
+            uint8_t pin;
+        };
+
+        PinHandle pinHandles[MAX_PIN_HANDLES];
+        uint8_t pinHandleCount = 0;
+
+        PinHandle* handle(Cell h) // helper (not Brief instruction)
+        {
+            if (h < 0 || h >= pinHandleCount)
+            {
+                error(VM_ERROR_OUT_OF_MEMORY); // indexed beyond handle table
+                return 0;
+            }
+
+            return &pinHandles[h];
+        }
+
+        void pinHandle()
+        {
+            uint8_t pin = pop(), h = 0;
+            while (h < pinHandleCount && pinHandles[h].pin != pin) h++;
+            if (h == pinHandleCount) // not yet resolved
+            {
+#if defined(NUM_DIGITAL_PINS)
+                if (pin >= NUM_DIGITAL_PINS) h = MAX_PIN_HANDLES;
+#endif
+                if (h >= MAX_PIN_HANDLES)
+                {
+                    error(VM_ERROR_OUT_OF_MEMORY);
+                    push(-1);
+                    return;
+                }
+
+                PinHandle& ph = pinHandles[h];
+                ph.pin = pin;
+#if PORT_IO
+                auto port = digitalPinToPort(pin); // port number on AVR, PortGroup* on SAMD
+                ph.out = (volatile PortBits*)portOutputRegister(port);
+                ph.in = (volatile PortBits*)portInputRegister(port);
+                ph.mask = digitalPinToBitMask(pin);
+                ph.shift = portHalf && (ph.mask >> portHalf) ? portHalf : 0;
+#endif
+                pinHandleCount++;
+            }
+            push(h);
+        }
+
+        inline void writePort(Cell h, PortBits bits, PortBits mask) // helper (not Brief instruction)
+        {
+            PinHandle* ph = handle(h);
+            if (ph == 0) return;
+#if PORT_IO
+            mask = (mask & cellBits) << ph->shift;
+            bits = (bits & cellBits) << ph->shift;
+            PORT_LOCK();
+            *ph->out = (*ph->out & ~mask) | (bits & mask);
+            PORT_UNLOCK();
+#else
+            if (mask & 1) ::digitalWrite(ph->pin, bits & 1 ? HIGH : LOW);
+#endif
+        }
+
+        inline Cell readPort(Cell h) // helper (not Brief instruction)
+        {
+            PinHandle* ph = handle(h);
+            if (ph == 0) return 0;
+#if PORT_IO
+            return (Cell)((*ph->in >> ph->shift) & cellBits);
+#else
+            return ::digitalRead(ph->pin) == HIGH ? 1 : 0;
+#endif
+        }
+
+        inline void writePin(Cell h, bool value) // helper (not Brief instruction)
+        {
+            PinHandle* ph = handle(h);
+            if (ph == 0) return;
+#if PORT_IO
+            PORT_LOCK();
+            if (value) *ph->out |= ph->mask;
+            else *ph->out &= ~ph->mask;
+            PORT_UNLOCK();
+#else
+            ::digitalWrite(ph->pin, value ? HIGH : LOW);
+#endif
+        }
+
+        inline bool readPin(Cell h) // helper (not Brief instruction)
+        {
+            PinHandle* ph = handle(h);
+            if (ph == 0) return false;
+#if PORT_IO
+            return (*ph->in & ph->mask) != 0;
+#else
+            return ::digitalRead(ph->pin) == HIGH;
+#endif
+        }
+
+        inline void togglePin(Cell h) // helper (not Brief instruction)
+        {
+            PinHandle* ph = handle(h);
+            if (ph == 0) return;
+#if PORT_IO
+            PORT_LOCK();
+            *ph->out ^= ph->mask;
+            PORT_UNLOCK();
+#else
+            ::digitalWrite(ph->pin, ::digitalRead(ph->pin) == HIGH ? LOW : HIGH);
+#endif
+        }
+
+        void pinWrite()
+        {
+            Cell h = pop();
+            writePin(h, pop() != 0);
+        }
+
+        void pinRead()
+        {
+            push(boolval(readPin(pop())));
+        }
+
+        void pinToggle()
+        {
+            togglePin(pop());
+        }
+
+        void portRead()
+        {
+            push(readPort(pop()));
+        }
+
+        void portWrite()
+        {
+            Cell h = pop(), mask = pop();
+            writePort(h, pop(), mask);
+        }
+
+        void analogRead()
+        {
+            push(::analogRead(pop()));
+        }
+
+        void analogWrite()
+        {
+            ::analogWrite(pop(), pop());
+        }
+
+        /* Sampling several channels at a fixed rate by `analogRead` from the loop word costs more in
+        dispatch than in conversion, and the timing varies with what else the VM is doing. Instead,
+        `acquire` (channels n ring frames us -) registers a list of n analog pins (bytes at `channels`)
+        and a ring of frames (an index cell followed by frames * n samples, laid out as for `average`)
+        into which a frame of one sample per channel is taken every `us` microseconds (up to 65535).
+        The samples of a frame are in channel order and frames overwrite the oldest. Zero channels stops
+        acquisition. `acquireIndex` (- index) gives the element at which the next frame will be written;
+        the index cell of the ring being kept up to date as well. A range (not wrapping) of the ring
+        may be streamed out with `telemetryBlock` without passing through the stack.
+
+        Acquisition is polled upon each pass of `loop()` against a `micros()` deadline, keeping phase as
+        with `setLoopPeriod`. Jitter is then bounded by the time a pass takes. Where that's not good
+        enough, a period of zero leaves the sampling to the sketch: `acquireFrame()` may be called from
+        a hardware timer interrupt (e.g. a Teensy IntervalTimer) or an ADC conversion-complete handler.
+        `acquireIndex` reads with interrupts disabled so that a frame is never seen half-written. */
+
+        uint8_t acquirePins[ACQUIRE_CHANNELS]; // analog pins sampled (copied from the dictionary)
+        uint8_t acquireChannels = 0; // channels per frame (0 when stopped)
+        int16_t acquireRing; // address of ring
+        uint16_t acquireLength; // samples in ring (frames * channels)
+        volatile uint16_t acquireNext; // sample at which next frame is written
+        uint16_t acquirePeriod; // microseconds between frames (0 = driven by sketch)
+        uint32_t acquireDue; // micros() at which next frame is due
+
+        void acquire()
+        {
+            uint16_t us = pop();
+            Cell frames = pop(), address = pop(), n = pop(), channels = pop();
+            acquireChannels = 0; // stopped while being set up
+            if (n <= 0) return;
+            if (n > ACQUIRE_CHANNELS || frames < 1)
+            {
+                error(VM_ERROR_OUT_OF_MEMORY);
+                return;
+            }
+            if (!span(channels, n, 1) || !span(address, (Wide)frames * n + 1, 2)) return;
+
+            for (uint8_t c = 0; c < n; c++) acquirePins[c] = memory[channels + c];
+            acquireRing = address;
+            acquireLength = frames * n;
+            acquireNext = 0;
+            setElement(memory + address, 0);
+            acquirePeriod = us;
+            acquireDue = micros();
+            acquireChannels = n;
+        }
+
+        void acquireFrame() // sample each channel into ring (may be called from ISR)
+        {
+            uint8_t n = acquireChannels;
+            if (n == 0) return;
+            uint16_t i = acquireNext;
+            uint8_t* e = memory + acquireRing + 2 + i * 2;
+            for (uint8_t c = 0; c < n; c++, e += 2) setElement(e, ::analogRead(acquirePins[c]));
+            i += n;
+            if (i >= acquireLength) i = 0;
+            acquireNext = i;
+            setElement(memory + acquireRing, i);
+        }
+
+        void acquireIndex()
+        {
+            noInterrupts();
+            uint16_t i = acquireNext;
+            interrupts();
+            push(i);
+        }
+
+        void pollAcquire() // take frame if due (helper)
+        {
+            if (acquireChannels == 0 || acquirePeriod == 0) return;
+            int32_t late = micros() - acquireDue;
+            if (late < 0) return; // not yet due
+            if (late >= acquirePeriod) acquireDue += (uint32_t)(late / acquirePeriod) * acquirePeriod; // skip missed
+            acquireDue += acquirePeriod;
+            acquireFrame();
+        }
+
+        /* A loop word sending a reading every pass floods the link with duplicates for the PC to throw
+        away. Instead, pins may be watched from a table evaluated natively upon each pass of `loop()`;
+        sending an event only upon change. So link usage scales with signal activity rather than with
+        loop rate:
+
+          watchDigital    pin mode id             -    (upon edge; mode as attachISR: CHANGE, RISING, FALLING)
+          watchAnalog     pin deadband id         -    (upon moving more than deadband from last sent)
+          watchThreshold  pin level hysteresis id -    (upon rising to level or falling below level less hysteresis)
+          unwatch         pin                     -
+
+        Events carry the reading; the pin level (-1 or 0) for digital watches, the analog value for
+        analog watches and whether above the level (-1 or 0) for threshold watches. An event with the
+        current reading is sent upon registering, so that the PC starts in sync. Watching an already
+        watched pin replaces the watch. Up to MAX_WATCHES are kept (until reset). Edges shorter than a
+        pass may be missed; a sketch wanting better may call `pollWatchesISR()` from a pin change interrupt
+        handler as well (sending events through the interrupt context ring rather than the main one). */
+
+        struct Watch
+        {
+            uint8_t pin;
+            uint8_t kind; // WATCH_DIGITAL, WATCH_ANALOG or WATCH_THRESHOLD
+            uint8_t mode; // edges of digital watch (CHANGE, RISING or FALLING)
+            uint8_t id; // event ID
+            int16_t level; // deadband of analog watch, level of threshold watch
+            int16_t hysteresis; // of threshold watch
+            int16_t last; // reading last sent
+        };
+
+        Watch watches[MAX_WATCHES];
+        uint8_t watchCount = 0;
+
+        void checkWatch(Watch& w, bool initial) // send event upon change (helper)
+        {
+            int16_t x;
+            bool changed;
+            switch (w.kind)
+            {
+                case WATCH_DIGITAL:
+                    x = boolval(::digitalRead(w.pin) == HIGH);
+                    changed = x != w.last;
+                    w.last = x;
+                    if (!initial && changed && w.mode != CHANGE && (w.mode == RISING) != (x != 0)) return; // unwanted edge
+                    break;
+                case WATCH_ANALOG:
+                    x = ::analogRead(w.pin);
+                    changed = x - w.last > w.level || w.last - x > w.level;
+                    if (changed || initial) w.last = x;
+                    break;
+                default: // WATCH_THRESHOLD
+                    x = ::analogRead(w.pin);
+                    x = boolval(w.last != 0 ? x >= w.level - w.hysteresis : x >= w.level);
+                    changed = x != w.last;
+                    w.last = x;
+                    break;
+            }
+            if (changed || initial) event(w.id, x);
+        }
+
+        void watch(uint8_t pin, uint8_t kind, uint8_t mode, int16_t level, int16_t hysteresis, uint8_t id) // helper
+        {
+            uint8_t i = 0;
+            while (i < watchCount && watches[i].pin != pin) i++;
+            if (i >= MAX_WATCHES)
+            {
+                error(VM_ERROR_OUT_OF_MEMORY); // table full
+                return;
+            }
+
+            Watch& w = watches[i];
+            w.pin = pin;
+            w.kind = kind;
+            w.mode = mode;
+            w.level = level;
+            w.hysteresis = hysteresis;
+            w.id = id;
+            w.last = 0;
+            if (i == watchCount) watchCount++;
+            checkWatch(w, true);
+        }
+
+        void watchDigital()
+        {
+            uint8_t id = pop(), mode = pop(), pin = pop();
+            watch(pin, WATCH_DIGITAL, mode, 0, 0, id);
+        }
+
+        void watchAnalog()
+        {
+            uint8_t id = pop();
+            int16_t deadband = pop();
+            uint8_t pin = pop();
+            watch(pin, WATCH_ANALOG, 0, deadband, 0, id);
+        }
+
+        void watchThreshold()
+        {
+            uint8_t id = pop();
+            int16_t hysteresis = pop(), level = pop();
+            uint8_t pin = pop();
+            watch(pin, WATCH_THRESHOLD, 0, level, hysteresis, id);
+        }
+
+        void unwatch()
+        {
+            uint8_t pin = pop();
+            for (uint8_t i = 0; i < watchCount; i++)
+            {
+                if (watches[i].pin == pin)
+                {
+                    watches[i] = watches[--watchCount]; // move last into place
+                    return;
+                }
+            }
+        }
+
+        void pollWatches() // evaluate watch table (from `loop()`; see pollWatchesISR)
+        {
+            for (uint8_t i = 0; i < watchCount; i++) checkWatch(watches[i], false);
+        }
+
+        void pollWatchesISR() // evaluate watch table from a sketch's interrupt handler
+        {
+            bool context = isrContext;
+            isrContext = true; // events by way of interrupt context ring
+            pollWatches();
+            isrContext = context;
+        }
+
+        /* I2C support comes from several instructions, essentially mapping composable, zero-operand
+        instructions to functions in the Arduino library:
+
+        http://arduino.cc/en/Reference/Wire
+
+        Brief words (addresses/quotations) may be hooked to respond to Wire events.
+
+        Byte-at-a-time transfers cost several dispatches per byte; reading a block of IMU registers
+        taking a couple dozen. Blocks may instead be transferred directly to and from the dictionary:
+
+          wireReadBlock      addr n device     - count    (request and read n bytes to addr)
+          wireWriteBlock     addr n device     - status   (transmit n bytes from addr)
+          wireReadRegisters  addr n reg device - count    (write register, repeated start, read n)
+
+        The count is of bytes actually read; short upon a device sending fewer or upon timing out. The
+        status is that of `Wire.endTransmission()` (0 upon success); as is the negated status given by
+        `wireReadRegisters` upon failing to write the register. Rather than spinning indefinitely, reads
+        wait at most WIRE_TIMEOUT microseconds for each byte; `wireRead` giving -1 upon timing out. Where
+        the core supports it, the bus itself is also given the timeout (recovering from a hung bus). */
+
+        void wireBegin()
+        {
+            Wire.begin(); // join bus as master (slave not supported)
+#if defined(WIRE_HAS_TIMEOUT)
+            Wire.setWireTimeout(WIRE_TIMEOUT, true); // reset bus upon timeout
+#endif
+        }
+
+        void wireRequestFrom()
+        {
+            Wire.requestFrom(pop(), pop());
+        }
+
+        void wireAvailable()
+        {
+            push(Wire.available());
+        }
+
+        bool wireAwait() // wait (up to WIRE_TIMEOUT) for received byte (helper)
+        {
+            uint32_t start = micros();
+            while (Wire.available() < 1)
+            {
+                if (micros() - start >= WIRE_TIMEOUT) return false;
+            }
+            return true;
+        }
+
+        void wireRead()
+        {
+            push(wireAwait() ? Wire.read() : -1);
+        }
+
+        uint8_t wireReceive(Cell address, Cell n, uint8_t device) // request block into dictionary (helper)
+        {
+            uint8_t count = Wire.requestFrom((int)device, (int)(n < 0xFF ? n : 0xFF));
+            uint8_t i = 0;
+            while (i < count && wireAwait()) memory[address + i++] = Wire.read();
+            return i;
+        }
+
+        void wireReadBlock()
+        {
+            uint8_t device = pop();
+            Cell n = pop(), address = pop();
+            push(n > 0 && span(address, n, 1) ? wireReceive(address, n, device) : 0);
+        }
+
+        void wireWriteBlock()
+        {
+            uint8_t device = pop();
+            Cell n = pop(), address = pop();
+            if (!span(address, n, 1))
+            {
+                push(4); // "other error"
+                return;
+            }
+            Wire.beginTransmission(device);
+            for (const uint8_t* b = memory + address; n > 0; n--) Wire.write(*b++);
+            push(Wire.endTransmission());
+        }
+
+        void wireReadRegisters()
+        {
+            uint8_t device = pop(), reg = pop();
+            Cell n = pop(), address = pop();
+            if (n <= 0 || !span(address, n, 1))
+            {
+                push(0);
+                return;
+            }
+            Wire.beginTransmission(device);
+            Wire.write(reg);
+            uint8_t status = Wire.endTransmission(false); // repeated start
+            push(status != 0 ? -(Cell)status : wireReceive(address, n, device));
+        }
+
+        void wireBeginTransmission()
+        {
+            Wire.beginTransmission((uint8_t)pop());
+        }
+
+        void wireWrite()
+        {
+            Wire.write((uint8_t)pop());
+        }
+
+        void wireEndTransmission()
+        {
+            Wire.endTransmission();
+        }
+
+        int16_t onReceiveWord = -1;
+        static Machine* onReceiveMachine; // instance last hooking receive
+
+        static void wireOnReceive(int count)
+        {
+            Machine* m = onReceiveMachine;
+            if (m->onReceiveWord != -1)
+            {
+                m->push(count);
+                m->exec(m->onReceiveWord);
+            }
+        }
+
+        void wireSetOnReceive()
+        {
+            onReceiveWord = pop();
+            onReceiveMachine = this;
+            Wire.onReceive(wireOnReceive);
+        }
+
+        int16_t onRequestWord = -1;
+        static Machine* onRequestMachine; // instance last hooking request
+
+        static void wireOnRequest()
+        {
+            Machine* m = onRequestMachine;
+            if (m->onRequestWord != -1)
+            {
+                m->exec(m->onRequestWord);
+            }
+        }
+
+        void wireSetOnRequest()
+        {
+            onRequestWord = pop();
+            onRequestMachine = this;
+            Wire.onRequest(wireOnRequest);
+        }
+
+        /* Brief word addresses (or quotations) may be set to run upon interrupts. For more info on
+        the argument values and behavior, see:
+
+        http://arduino.cc/en/Reference/AttachInterrupt
+
+        We keep a mapping of up to MAX_INTERRUPTS (7) words.
+
+        Interrupts may well arrive while the main context is in the middle of running some word. Words
+        attached with `attachISR` run immediately, but within a separate interrupt context having its
+        own (small) data and return stacks and program counter. The registers and stack pointers of the
+        interrupted context are saved and restored afterward (the budget countdown too, with BUDGET).
+        The dictionary is shared of course. Events (and errors) raised by an interrupt word go to a ring
+        of their own, moved into the event ring by the next pass of `loop()`; never disturbing an event
+        the main context is transmitting or packing.
+
+        Words attached with `attachDeferredISR` are instead queued (in a lock-free ring; the interrupt
+        being the only producer) and run by the main context upon the next pass of `loop()`. This is the
+        safer choice for anything but the lightest of work. Should the queue be full, the interrupt is
+        dropped. */
+
+        int16_t isrs[MAX_INTERRUPTS];
+        uint8_t isrModes[MAX_INTERRUPTS]; // as given to attachInterrupt
+        uint8_t isrsDeferred = 0; // bit per interrupt
+
+        Cell isrData[ISR_DATA_STACK_SIZE + 1]; // interrupt context eval stack ([0] unused)
+        Cell isrReturn[ISR_RETURN_STACK_SIZE + 1]; // interrupt context return stack ([0] unused)
+
+        volatile int16_t isrQueue[ISR_QUEUE_SIZE]; // deferred interrupt words
+        volatile uint8_t isrQueueHead = 0; // next to be queued (written only by interrupts)
+        volatile uint8_t isrQueueTail = 0; // next to be run (written only by `loop()`)
+
+        static Machine* interruptMachines[MAX_INTERRUPTS]; // instance last attaching each interrupt
+
+        void interrupt(int16_t n) // helper (not Brief instruction)
+        {
+            int16_t w = isrs[n];
+            if (w == -1) return;
+            if (isrsDeferred & (1 << n))
+            {
+                uint8_t head = isrQueueHead;
+                uint8_t next = (head + 1) & (ISR_QUEUE_SIZE - 1);
+                if (next == isrQueueTail) return; // full (dropped)
+                isrQueue[head] = w;
+                isrQueueHead = next; // publish
+                return;
+            }
+
+            // switch to interrupt context
+            int16_t pp = p;
+            Cell *ss = s, *rr = r;
+            Cell *ds = dstack, *dl = dlimit, *rs = rstack, *rl = rlimit;
+            int8_t t = task;
+            task = -1; // not yieldable
+#if BUDGET
+            bool pre = preempt;
+            preempt = false; // nor suspendable
+            uint16_t cd = countdown, ch = chunk; // rewound by `spent()` upon expiring
+#endif
+            isrContext = true;
+            dstack = s = isrData;
+            dlimit = isrData + ISR_DATA_STACK_SIZE;
+            rstack = isrReturn;
+            rlimit = isrReturn + ISR_RETURN_STACK_SIZE;
+
+            exec(w);
+
+            // restore interrupted context
+            p = pp; s = ss; r = rr;
+            dstack = ds; dlimit = dl; rstack = rs; rlimit = rl;
+            task = t;
+            isrContext = false;
+#if BUDGET
+            preempt = pre;
+            countdown = cd; chunk = ch;
+#endif
+        }
+
+        void runDeferred() // run queued deferred interrupt words (helper)
+        {
+            while (isrQueueTail != isrQueueHead)
+            {
+                uint8_t tail = isrQueueTail;
+                int16_t w = isrQueue[tail];
+                isrQueueTail = (tail + 1) & (ISR_QUEUE_SIZE - 1); // release slot
+                exec(w);
+            }
+        }
+
+        static void interrupt0() // helper (not Brief instruction)
+        {
+            interruptMachines[0]->interrupt(0);
+        }
+
+        static void interrupt1() // helper (not Brief instruction)
+        {
+            interruptMachines[1]->interrupt(1);
+        }
+
+        static void interrupt2() // helper (not Brief instruction)
+        {
+            interruptMachines[2]->interrupt(2);
+        }
+
+        static void interrupt3() // helper (not Brief instruction)
+        {
+            interruptMachines[3]->interrupt(3);
+        }
+
+        static void interrupt4() // helper (not Brief instruction)
+        {
+            interruptMachines[4]->interrupt(4);
+        }
+
+        static void interrupt5() // helper (not Brief instruction)
+        {
+            interruptMachines[5]->interrupt(5);
+        }
+
+        static void interrupt6() // helper (not Brief instruction)
+        {
+            interruptMachines[6]->interrupt(6);
+        }
+
+        void attach(bool deferred) // helper (not Brief instruction)
+        {
+            uint8_t mode = pop();
+            uint8_t interrupt = pop();
+            int16_t w = pop();
+            if (interrupt >= MAX_INTERRUPTS)
+            {
+                error(VM_ERROR_OUT_OF_MEMORY); // indexed beyond ISR table
+                return;
+            }
+            attachWord(w, interrupt, mode, deferred);
+        }
+
+        void attachWord(int16_t w, uint8_t interrupt, uint8_t mode, bool deferred) // helper
+        {
+            isrs[interrupt] = w;
+            isrModes[interrupt] = mode;
+            interruptMachines[interrupt] = this;
+            if (deferred) isrsDeferred |= 1 << interrupt;
+            else isrsDeferred &= ~(1 << interrupt);
+            switch (interrupt)
+            {
+                case 0 : attachInterrupt(0, interrupt0, mode); break;
+                case 1 : attachInterrupt(1, interrupt1, mode); break;
+                case 2 : attachInterrupt(2, interrupt2, mode); break;
+                case 3 : attachInterrupt(3, interrupt3, mode); break;
+                case 4 : attachInterrupt(4, interrupt4, mode); break;
+                case 5 : attachInterrupt(5, interrupt5, mode); break;
+                case 6 : attachInterrupt(6, interrupt6, mode); break;
+            }
+        }
+
+        void attachISR() // run immediately in interrupt context
+        {
+            attach(false);
+        }
+
+        void attachDeferredISR() // queue to run from `loop()`
+        {
+            attach(true);
+        }
+
+        void detachISR()
+        {
+            uint8_t interrupt = pop();
+            if (interrupt >= MAX_INTERRUPTS)
+            {
+                error(VM_ERROR_OUT_OF_MEMORY); // indexed beyond ISR table
+                return;
+            }
+            detachInterrupt(interrupt);
+            isrs[interrupt] = -1;
+            isrsDeferred &= ~(1 << interrupt);
+        }
+
+#if PERSIST
+
+        /* After a reset, the dictionary is empty until the PC sends definitions down again; several
+        seconds at 19200 baud for a standard library, and the board can't run on its own. Instead, the
+        dictionary image may be saved to EEPROM by `save` (tag -) along with `here`, `last`, the loop
+        word (and period), the ISR table and the call vectors. The image is restored by `restore`, replacing the dictionary
+        and reattaching the ISR words (and ending the code running, having been replaced, along with its
+        tasks, acquisition, watches, pin handles, telemetry and deferred ISR words), and by default also
+        upon `setup()`; so that the loop word resumes without waiting on the PC. An image is only restored
+        if its format version matches PERSIST_VERSION, it fits the dictionary, `last`, the loop word and
+        the ISR words lie within it and its CRC (CRC-16/CCITT) checks out. `forgetImage` invalidates the
+        saved image.
+
+        The tag is for the PC to identify the image (e.g. a hash of the code it sent down); sent by
+        `imageTag` in an IMAGE_EVENT_ID event (no data if no valid image is saved) and upon `restore`
+        (or being restored by `setup()`). A PC finding the image it would upload already saved restores it rather
+        than sending every definition again. Saving writes only bytes that changed (`EEPROM.update`) but
+        EEPROM writes are slow (~3ms/byte on AVR); `save` is best done once after uploading.
+
+          Magic:  'B', version
+          Header: here, last, loop word, loop period, tag (2 bytes each), deferred ISR bits,
+                  ISR word (2 bytes) and mode per interrupt, call vectors (2 bytes each)
+          Image:  memory[0..here)
+          CRC:    2 bytes (over all of the above) */
+
+        static const uint8_t imageMagic = 'B';
+        static const int16_t imageHeader = 13 + 3 * MAX_INTERRUPTS + 2 * CALL_VECTORS; // bytes preceding dictionary image
+
+        static uint16_t eeprom16(int16_t address) // helper (not Brief instruction)
+        {
+            return (uint16_t)EEPROM.read(address) << 8 | EEPROM.read(address + 1);
+        }
+
+        uint16_t imagePut(int16_t& address, uint8_t b, uint16_t crc) // write byte of image (helper)
+        {
+            EEPROM.update(address++, b);
+            return crc16(crc, b);
+        }
+
+        uint16_t imagePut16(int16_t& address, uint16_t x, uint16_t crc) // helper (not Brief instruction)
+        {
+            return imagePut(address, x, imagePut(address, x >> 8, crc));
+        }
+
+        static bool imageWord(int16_t address, uint16_t h) // saved address none (-1) or within image (helper)
+        {
+            uint16_t w = eeprom16(address);
+            return w == 0xFFFF || w < h;
+        }
+
+        bool imageValid() // saved image intact and fitting (helper)
+        {
+            int16_t a = PERSIST_ADDRESS;
+            if (EEPROM.read(a) != imageMagic || EEPROM.read(a + 1) != PERSIST_VERSION) return false;
+            uint16_t h = eeprom16(a + 2);
+            if (h > MemSize || (int32_t)a + imageHeader + h + 2 > (int32_t)EEPROM.length()) return false;
+            if (eeprom16(a + 4) > h || !imageWord(a + 6, h)) return false; // last, loop word
+            for (uint8_t i = 0; i < MAX_INTERRUPTS; i++)
+            {
+                if (!imageWord(a + 13 + 3 * i, h)) return false; // ISR words
+            }
+            uint16_t crc = 0xFFFF;
+            for (int16_t end = a + imageHeader + h; a < end; a++) crc = crc16(crc, EEPROM.read(a));
+            return crc == eeprom16(a);
+        }
+
+        void save()
+        {
+            uint16_t tag = pop();
+            int16_t a = PERSIST_ADDRESS;
+            if ((int32_t)a + imageHeader + here + 2 > (int32_t)EEPROM.length())
+            {
+                error(VM_ERROR_OUT_OF_MEMORY); // image doesn't fit EEPROM
+                return;
+            }
+
+            EEPROM.update(a++, 0); // invalid until complete
+            uint16_t crc = crc16(0xFFFF, imageMagic);
+            crc = imagePut(a, PERSIST_VERSION, crc);
+            crc = imagePut16(a, here, crc);
+            crc = imagePut16(a, last, crc);
+            crc = imagePut16(a, loopword, crc);
+            crc = imagePut16(a, loopPeriod, crc);
+            crc = imagePut16(a, tag, crc);
+            crc = imagePut(a, isrsDeferred, crc);
+            for (uint8_t i = 0; i < MAX_INTERRUPTS; i++)
+            {
+                crc = imagePut16(a, isrs[i], crc);
+                crc = imagePut(a, isrModes[i], crc);
+            }
+            for (uint8_t i = 0; i < CALL_VECTORS; i++) crc = imagePut16(a, vectors[i], crc);
+            for (int16_t i = 0; i < here; i++) crc = imagePut(a, memory[i], crc);
+            imagePut16(a, crc, 0);
+            EEPROM.update(PERSIST_ADDRESS, imageMagic);
+        }
+
+        bool restoreImage() // replace dictionary with saved image, if valid (helper)
+        {
+            if (!imageValid()) return false;
+            int16_t a = PERSIST_ADDRESS + 2;
+            for (uint8_t i = 0; i < MAX_INTERRUPTS; i++)
+            {
+                if (isrs[i] != -1) detachInterrupt(i);
+                isrs[i] = -1;
+            }
+            stopRuntime(); // of the code being replaced
+            here = eeprom16(a);
+            last = eeprom16(a + 2);
+            loopword = eeprom16(a + 4);
+            loopPeriod = eeprom16(a + 6);
+            loopDue = micros();
+            resetLoopStats();
+            unverify(0); // restored code runs checked
+            uint8_t deferred = EEPROM.read(a + 10);
+            int16_t isr = a + 11, v = isr + 3 * MAX_INTERRUPTS; // ISR table and vectors
+            for (uint8_t i = 0; i < CALL_VECTORS; i++, v += 2) vectors[i] = eeprom16(v);
+            for (int16_t i = 0; i < here; i++) memory[i] = EEPROM.read(v + i);
+            for (uint8_t i = 0; i < MAX_INTERRUPTS; i++, isr += 3) // attached once their words are in place
+            {
+                int16_t w = eeprom16(isr);
+                if (w != -1) attachWord(w, i, EEPROM.read(isr + 2), deferred & (1 << i));
+            }
+            return true;
+        }
+
+        void restore()
+        {
+            if (restoreImage())
+            {
+                r = rstack;
+                p = -1; // code running was in the replaced dictionary (end)
+            }
+            imageTag();
+        }
+
+        void forgetImage()
+        {
+            EEPROM.update(PERSIST_ADDRESS, 0);
+        }
+
+        void imageTag()
+        {
+            eventBegin(IMAGE_EVENT_ID, false);
+            if (imageValid())
+            {
+                uint16_t tag = eeprom16(PERSIST_ADDRESS + 10);
+                eventPut(tag >> 8);
+                eventPut(tag);
+            }
+            eventCommit();
+        }
+
+#endif // PERSIST
+
+        /* A couple of stragglers... */
+
+        void milliseconds()
+        {
+            push(millis());
+        }
+
+        void pulseIn()
+        {
+            push(::pulseIn(pop(), pop()));
+        }
+
+        /* Superinstructions fuse sequences that are very common in compiled Brief code into single
+        instructions; saving dispatches as well as dictionary space. The PC-side compiler emits these
+        automatically by peephole optimization. Several take the operand of a preceding `lit8`:
+
+          lit8 x +              lit8Add x           (signed x)
+          lit8 a @              lit8Fetch16 a       (unsigned address 0-255)
+          dup *                 dupMul
+          lit8 p digitalRead    lit8DigitalRead p   (unsigned pin 0-255)
+          swap -                swapSub
+          lit8 0 =              zeroEq */
+
+        void lit8Add()
+        {
+            *s = *s + (int8_t)memget(p++);
+        }
+
+        void lit8Fetch16()
+        {
+            push(mem16(memget(p++)));
+        }
+
+        void dupMul()
+        {
+            *s = *s * *s;
+        }
+
+        void lit8DigitalRead()
+        {
+            push(::digitalRead(memget(p++)) ? -1 : 0);
+        }
+
+        void swapSub()
+        {
+            Cell x = pop();
+            *s = x - *s;
+        }
+
+        void zeroEq()
+        {
+            *s = boolval(*s == 0);
+        }
+
+        /* Small constants (flags, pin modes, indices, ...) are common enough to have single-byte literal
+        instructions of their own; each saving the operand byte of `lit8`:
+
+          lit8 0                lit0
+          lit8 1                lit1
+          lit8 2                lit2
+          lit8 -1               litNeg1 */
+
+        void lit0()
+        {
+            push(0);
+        }
+
+        void lit1()
+        {
+            push(1);
+        }
+
+        void lit2()
+        {
+            push(2);
+        }
+
+        void litNeg1()
+        {
+            push(-1);
+        }
+
+        /* Calls to the most used words may instead go through a table of CALL_VECTORS words; a single
+        byte (`vcall0`-`vcall7`, calling the word in that slot) rather than a two-byte call. Slots are bound
+        by `setVector` (address slot -) and cleared by `resetBoard`. The compiler binds the words it chooses
+        to vector before emitting calls through them. As with calls, no return address is pushed when
+        followed by `return` (TCO). Calling through an unbound slot ends the run. Rebinding a slot forgets
+        verified stack effects (which may have been of the previous word). */
+
+        int16_t vectors[CALL_VECTORS]; // word address per slot (-1 unbound)
+
+        void setVector()
+        {
+            uint8_t slot = pop();
+            int16_t address = pop();
+            if (slot >= CALL_VECTORS) return;
+            if (vectors[slot] != -1) unverify(0);
+            vectors[slot] = address;
+        }
+
+        template <uint8_t slot>
+        void vcall() // call through vector table
+        {
+            if (memget(p) != 0) // not followed by return (TCO)
+                rpush(p); // return address
+            p = vectors[slot];
+            PROFILE_CALL(p);
+        }
+
+        /* The inline engines (DISPATCH_SWITCH and DISPATCH_THREADED) implement the core primitives
+        directly within `run()` rather than calling through the instruction table. The program counter
+        and stack pointers are kept in locals (registers, hopefully) for the duration. These are spilled
+        back to `p`, `s` and `r` before calling out to any instruction function (which may push, pop or
+        `pset`) and reloaded afterward.
+
+        With DISPATCH_THREADED, each primitive ends in its own copy of the fetch/decode sequence and
+        jumps straight to the next (computed goto). This avoids the call/return and gives the branch
+        predictor (on targets having one) a separate history per instruction. With DISPATCH_SWITCH the
+        same bodies become cases of a single switch.
+
+        Semantics are identical to the table-driven engine, bounds checks and all. Bytecodes at or above
+        CORE_PRIMITIVES (user instructions) are still called through the instruction table.
+
+        With TOS_CACHE, the top of the data stack is additionally kept in a local (`tos`). The slot in
+        `dstack` at `sp` is then stale and memory is touched only as elements are pushed down beneath the
+        top or popped back up. For example, `dup *` becomes a single store and load rather than three loads
+        and two stores. The cached value is written back before calling out (so that bound instructions
+        see it with `brief::pop()`) and reloaded afterward.
+
+        The engine is instantiated twice. The `checked` instance is the normal one. The unchecked instance
+        is used only for words whose stack effects were proven by the verifier (below) to fit; it elides
+        the stack bounds checks and the bounds checks on fetching code (but not data). */
+
+#if DISPATCH != DISPATCH_TABLE
+
+        inline uint8_t fetch(int16_t address) // helper (not Brief instruction)
+        {
+            return (uint16_t)address < MemSize ? memory[address] : memget(address); // memget raises OOM
+        }
+
+#if TOS_CACHE
+#define TOS tos // top of stack (the slot at `sp` is stale)
+#define SAVE() (p = ip, s = sp, r = rp, sp >= dstack ? *sp = tos : 0) // spill registers
+#define LOAD() (ip = p, sp = s, rp = r, tos = *sp) // reload registers
+#else
+#define TOS (*sp) // top of stack
+#define SAVE() (p = ip, s = sp, r = rp) // spill registers
+#define LOAD() (ip = p, sp = s, rp = r) // reload registers
+#endif
+#define OUT(f) do { SAVE(); f(); LOAD(); } while (0) // call out to instruction function
+
+#define CODE(a) (checked ? fetch(a) : memory[a]) // fetch instruction stream
+
+#if TOS_CACHE
+#define SPILL(v) (*sp++ = tos, tos = (v)) // shift TOS down into memory
+#define FILL() (tos = *--sp) // shift NOS up into the TOS register
+#define AT(n) ((n) == 0 ? tos : *(sp - (n))) // nth element
+#else
+#define SPILL(v) (*(++sp) = (v))
+#define FILL() (--sp)
+#define AT(n) (*(sp - (n)))
+#endif
+
+#define PUSH(x) do { Cell v = (x); \
+                         if (checked && sp >= dlimit) error(VM_ERROR_DATA_STACK_OVERFLOW); \
+                         else SPILL(v); } while (0)
+#define POP(x)  do { if (checked && sp <= dstack) { error(VM_ERROR_DATA_STACK_UNDERFLOW); x = 0; } \
+                         else { x = TOS; FILL(); } } while (0)
+
+#define RPUSH(x) do { Cell v = (x); \
+                          if (checked && rp >= rlimit) error(VM_ERROR_RETURN_STACK_OVERFLOW); \
+                          else *(++rp) = v; } while (0)
+#define RPOP(x)  do { if (checked && rp <= rstack) { error(VM_ERROR_RETURN_STACK_UNDERFLOW); x = 0; } \
+                          else x = *rp--; } while (0)
+
+#define BINARY(e) do { POP(x); TOS = (e); } while (0) // y x - (e)
+
+#if DISPATCH == DISPATCH_THREADED
+#define OP(n, name) op_##name:
+#define FETCH() do { i = CODE(ip); ip++; PROFILE_OP(i); TRACE_OP(ip - 1, i, TOS); if (i < CORE_PRIMITIVES) goto *ops[i]; goto other; } while (0)
+#if BUDGET
+#define NEXT() do { if (--steps == 0) goto expired; FETCH(); } while (0)
+#else
+#define NEXT() FETCH()
+#endif
+#else
+#define OP(n, name) case n:
+#define NEXT() continue
+#endif
+
+#define BRANCHED() if (ip < 0) goto done; else NEXT() // after changing `ip`
+
+        template <bool checked>
+        void interpret() // run code at p
+        {
+            int16_t ip = p;
+            Cell *sp = s, *rp = r;
+#if TOS_CACHE
+            Cell tos = *sp;
+#endif
+            Cell x, y;
+            uint8_t i;
+#if BUDGET
+            uint16_t steps = countdown;
+#endif
+
+#if DISPATCH == DISPATCH_THREADED
+            static void* const ops[CORE_PRIMITIVES] = {
+                &&op_ret, &&op_lit8, &&op_lit16, &&op_quote, &&op_eventHeader, &&op_eventBody8,
+                &&op_eventBody16, &&op_eventFooter, &&op_eventOp, &&op_fetch8, &&op_store8,
+                &&op_fetch16, &&op_store16, &&op_add, &&op_sub, &&op_mul, &&op_div, &&op_mod,
+                &&op_andb, &&op_orb, &&op_xorb, &&op_shift, &&op_eq, &&op_neq, &&op_gt, &&op_geq,
+                &&op_lt, &&op_leq, &&op_notb, &&op_neg, &&op_inc, &&op_dec, &&op_drop, &&op_dup,
+                &&op_swap, &&op_pick, &&op_roll, &&op_clr, &&op_pushr, &&op_popr, &&op_peekr,
+                &&op_forget, &&op_call, &&op_choice, &&op_chooseIf, &&op_loopTicks, &&op_setLoop,
+                &&op_stopLoop, &&op_resetBoard, &&op_pinMode, &&op_digitalRead, &&op_digitalWrite,
+                &&op_analogRead, &&op_analogWrite, &&op_attachISR, &&op_detachISR,
+                &&op_milliseconds, &&op_pulseIn, &&op_next, &&op_nop, &&op_lit8Add,
+                &&op_lit8Fetch16, &&op_dupMul, &&op_lit8DigitalRead, &&op_swapSub, &&op_zeroEq,
+                &&op_zbranch, &&op_branch, &&op_extension, &&op_mulDiv, &&op_mulQ8, &&op_mulQ15,
+                &&op_addSat, &&op_subSat, &&op_clamp, &&op_pinHandle, &&op_pinWrite, &&op_pinRead,
+                &&op_pinToggle, &&op_portRead, &&op_portWrite, &&op_lit0, &&op_lit1, &&op_lit2,
+                &&op_litNeg1, &&op_vcall0, &&op_vcall1, &&op_vcall2, &&op_vcall3, &&op_vcall4,
+                &&op_vcall5, &&op_vcall6, &&op_vcall7 };
+
+            NEXT();
+#else
+            for (;;)
+            {
+#if BUDGET
+                if (--steps == 0) goto expired;
+            unspent:
+#endif
+                i = CODE(ip); ip++;
+                PROFILE_OP(i);
+                TRACE_OP(ip - 1, i, TOS);
+                if (i >= CORE_PRIMITIVES) goto other;
+                switch (i)
+                {
+#endif
+                OP(0, ret) RPOP(ip); BRANCHED();
+                OP(1, lit8) PUSH((int8_t)CODE(ip)); ip++; NEXT();
+                OP(2, lit16) x = (int16_t)(CODE(ip) << 8 | CODE(ip + 1)); ip += 2; PUSH(x); NEXT();
+                OP(3, quote) i = CODE(ip); ip++; PUSH(ip); ip += i; NEXT();
+                OP(4, eventHeader) OUT(eventHeader); NEXT();
+                OP(5, eventBody8) OUT(eventBody8); NEXT();
+                OP(6, eventBody16) OUT(eventBody16); NEXT();
+                OP(7, eventFooter) OUT(eventFooter); NEXT();
+                OP(8, eventOp) OUT(eventOp); NEXT();
+                OP(9, fetch8) TOS = fetch(TOS); NEXT();
+                OP(10, store8) POP(x); POP(y); memset(x, y); NEXT();
+                OP(11, fetch16) x = TOS; TOS = (int16_t)(fetch(x) << 8 | fetch(x + 1)); NEXT();
+                OP(12, store16) POP(x); POP(y); memset(x, y >> 8); memset(x + 1, y); NEXT();
+                OP(13, add) BINARY(TOS + x); NEXT();
+                OP(14, sub) BINARY(TOS - x); NEXT();
+                OP(15, mul) BINARY(TOS * x); NEXT();
+                OP(16, div) BINARY(TOS / x); NEXT();
+                OP(17, mod) BINARY(TOS % x); NEXT();
+                OP(18, andb) BINARY(TOS & x); NEXT();
+                OP(19, orb) BINARY(TOS | x); NEXT();
+                OP(20, xorb) BINARY(TOS ^ x); NEXT();
+                OP(21, shift) BINARY(x < 0 ? TOS << -x : TOS >> x); NEXT();
+                OP(22, eq) BINARY(boolval(TOS == x)); NEXT();
+                OP(23, neq) BINARY(boolval(TOS != x)); NEXT();
+                OP(24, gt) BINARY(boolval(TOS > x)); NEXT();
+                OP(25, geq) BINARY(boolval(TOS >= x)); NEXT();
+                OP(26, lt) BINARY(boolval(TOS < x)); NEXT();
+                OP(27, leq) BINARY(boolval(TOS <= x)); NEXT();
+                OP(28, notb) TOS = ~(TOS); NEXT();
+                OP(29, neg) TOS = -(TOS); NEXT();
+                OP(30, inc) TOS = TOS + 1; NEXT();
+                OP(31, dec) TOS = TOS - 1; NEXT();
+                OP(32, drop) FILL(); NEXT();
+                OP(33, dup) PUSH(TOS); NEXT();
+                OP(34, swap) x = TOS; TOS = *(sp - 1); *(sp - 1) = x; NEXT();
+                OP(35, pick) POP(x); PUSH(AT(x)); NEXT();
+                OP(36, roll) OUT(roll); NEXT();
+                OP(37, clr) sp = dstack; NEXT();
+                OP(38, pushr) POP(x); RPUSH(x); NEXT();
+                OP(39, popr) RPOP(x); PUSH(x); NEXT();
+                OP(40, peekr) PUSH(*rp); NEXT();
+                OP(41, forget) OUT(forget); NEXT();
+                OP(42, call) RPUSH(ip); POP(ip); BRANCHED();
+                OP(43, choice) POP(x); POP(y); RPUSH(ip); POP(ip); ip = ip == 0 ? x : y; BRANCHED();
+                OP(44, chooseIf) POP(x); POP(y); if (y != 0) { RPUSH(ip); ip = x; } BRANCHED();
+                OP(45, loopTicks) OUT(loopTicks); NEXT();
+                OP(46, setLoop) OUT(setLoop); NEXT();
+                OP(47, stopLoop) OUT(stopLoop); NEXT();
+                OP(48, resetBoard) OUT(resetBoard); NEXT();
+                OP(49, pinMode) OUT(pinMode); NEXT();
+                OP(50, digitalRead) OUT(digitalRead); NEXT();
+                OP(51, digitalWrite) OUT(digitalWrite); NEXT();
+                OP(52, analogRead) OUT(analogRead); NEXT();
+                OP(53, analogWrite) OUT(analogWrite); NEXT();
+                OP(54, attachISR) OUT(attachISR); NEXT();
+                OP(55, detachISR) OUT(detachISR); NEXT();
+                OP(56, milliseconds) OUT(milliseconds); NEXT();
+                OP(57, pulseIn) OUT(pulseIn); NEXT();
+                OP(58, next)
+                    RPOP(x);
+                    i = CODE(ip); ip++;
+                    if (--x > 0)
+                    {
+                        RPUSH(x);
+                        ip -= (i + 2);
+                    }
+                    BRANCHED();
+                OP(59, nop) NEXT();
+                OP(60, lit8Add) TOS = TOS + (int8_t)CODE(ip); ip++; NEXT();
+                OP(61, lit8Fetch16) x = CODE(ip); ip++; y = (int16_t)(fetch(x) << 8 | fetch(x + 1)); PUSH(y); NEXT();
+                OP(62, dupMul) TOS = TOS * TOS; NEXT();
+                OP(63, lit8DigitalRead) OUT(lit8DigitalRead); NEXT();
+                OP(64, swapSub) BINARY(x - TOS); NEXT();
+                OP(65, zeroEq) TOS = boolval(TOS == 0); NEXT();
+                OP(66, zbranch) i = CODE(ip); ip++; POP(x); if (x == 0) ip += (int8_t)i; NEXT();
+                OP(67, branch) i = CODE(ip); ip++; ip += (int8_t)i; NEXT();
+                OP(68, extension) OUT(extension); BRANCHED();
+                OP(69, mulDiv) POP(x); POP(y); TOS = mulDivBy((Wide)TOS * y, x); NEXT();
+                OP(70, mulQ8) BINARY(saturated(((Wide)TOS * x + 0x80) >> 8)); NEXT();
+                OP(71, mulQ15) BINARY(saturated(((Wide)TOS * x + 0x4000) >> 15)); NEXT();
+                OP(72, addSat) BINARY(saturated((Wide)TOS + x)); NEXT();
+                OP(73, subSat) BINARY(saturated((Wide)TOS - x)); NEXT();
+                OP(74, clamp) POP(x); POP(y); TOS = TOS < y ? y : TOS > x ? x : TOS; NEXT();
+                OP(75, pinHandle) OUT(pinHandle); NEXT();
+                OP(76, pinWrite) POP(x); POP(y); writePin(x, y != 0); NEXT();
+                OP(77, pinRead) TOS = boolval(readPin(TOS)); NEXT();
+                OP(78, pinToggle) POP(x); togglePin(x); NEXT();
+                OP(79, portRead) TOS = readPort(TOS); NEXT();
+                OP(80, portWrite) POP(x); POP(y); { Cell bits; POP(bits); writePort(x, bits, y); } NEXT();
+                OP(81, lit0) PUSH(0); NEXT();
+                OP(82, lit1) PUSH(1); NEXT();
+                OP(83, lit2) PUSH(2); NEXT();
+                OP(84, litNeg1) PUSH(-1); NEXT();
+                OP(85, vcall0) x = vectors[0]; goto vcall;
+                OP(86, vcall1) x = vectors[1]; goto vcall;
+                OP(87, vcall2) x = vectors[2]; goto vcall;
+                OP(88, vcall3) x = vectors[3]; goto vcall;
+                OP(89, vcall4) x = vectors[4]; goto vcall;
+                OP(90, vcall5) x = vectors[5]; goto vcall;
+                OP(91, vcall6) x = vectors[6]; goto vcall;
+                OP(92, vcall7) x = vectors[7]; goto vcall;
+#if DISPATCH == DISPATCH_SWITCH
+                }
+#endif
+            other:
+                if ((i & 0x80) == 0) // user instruction
+                {
+                    OUT(instructions[i]);
+                }
+                else // address to call
+                {
+                    if (CODE(ip + 1) != 0) // not followed by return (TCO)
+                        RPUSH(ip + 1); // return address
+                    ip = ((i << 8) & 0x7F00) | CODE(ip); // jump
+                    PROFILE_CALL(ip);
+                }
+                BRANCHED();
+            vcall: // call through vector table (to x)
+                if (CODE(ip) != 0) // not followed by return (TCO)
+                    RPUSH(ip); // return address
+                ip = x;
+                PROFILE_CALL(ip);
+                BRANCHED();
+#if BUDGET
+            expired: // time to check budget
+                SAVE();
+                if (spent())
+                {
+                    suspend();
+                    return;
+                }
+                steps = countdown;
+                LOAD();
+#if DISPATCH == DISPATCH_THREADED
+                FETCH();
+#else
+                goto unspent;
+#endif
+#endif
+#if DISPATCH == DISPATCH_SWITCH
+            }
+#endif
+        done:
+            SAVE();
+#if BUDGET
+            countdown = steps;
+#endif
+        }
+
+        void run() // run code at p
+        {
+            Machine* m = current;
+            current = this;
+            interpret<true>();
+            current = m;
+        }
+
+        void runUnchecked() // run verified code at p without bounds checks
+        {
+            Machine* m = current;
+            current = this;
+            interpret<false>();
+            current = m;
+        }
+
+#undef SAVE
+#undef LOAD
+#undef TOS
+#undef OUT
+#undef SPILL
+#undef FILL
+#undef AT
+#undef CODE
+#undef PUSH
+#undef POP
+#undef RPUSH
+#undef RPOP
+#undef BINARY
+#undef OP
+#undef FETCH
+#undef NEXT
+#undef BRANCHED
+
+#endif // DISPATCH != DISPATCH_TABLE
+
+        /* Setup binds all of the instruction functions from above (see Brief.cpp for hooking the VM into
+        the main setup and loop of the hosting project, and for binding custom instructions). */
+
+        void setup()
+        {
+            setup(Serial, DEFAULT_BAUD);
+        }
+
+        template <typename Port>
+        void setup(Port& port, unsigned long baud) // initialize over given port at given speed
+        {
+            port.begin(baud);
+            setup((Stream&)port);
+        }
+
+        void setup(Stream& stream, bool blocking = false) // initialize over given (begun) stream
+        {
+            transport = &stream;
+            transportBlocking = blocking;
+            resetBoard();
+
+            bind(0,  thunk<&Machine::ret>);
+            bind(1,  thunk<&Machine::lit8>);
+            bind(2,  thunk<&Machine::lit16>);
+            bind(3,  thunk<&Machine::quote>);
+            bind(4,  thunk<&Machine::eventHeader>);
+            bind(5,  thunk<&Machine::eventBody8>);
+            bind(6,  thunk<&Machine::eventBody16>);
+            bind(7,  thunk<&Machine::eventFooter>);
+            bind(8,  thunk<&Machine::eventOp>);
+            bind(9,  thunk<&Machine::fetch8>);
+            bind(10, thunk<&Machine::store8>);
+            bind(11, thunk<&Machine::fetch16>);
+            bind(12, thunk<&Machine::store16>);
+            bind(13, thunk<&Machine::add>);
+            bind(14, thunk<&Machine::sub>);
+            bind(15, thunk<&Machine::mul>);
+            bind(16, thunk<&Machine::div>);
+            bind(17, thunk<&Machine::mod>);
+            bind(18, thunk<&Machine::andb>);
+            bind(19, thunk<&Machine::orb>);
+            bind(20, thunk<&Machine::xorb>);
+            bind(21, thunk<&Machine::shift>);
+            bind(22, thunk<&Machine::eq>);
+            bind(23, thunk<&Machine::neq>);
+            bind(24, thunk<&Machine::gt>);
+            bind(25, thunk<&Machine::geq>);
+            bind(26, thunk<&Machine::lt>);
+            bind(27, thunk<&Machine::leq>);
+            bind(28, thunk<&Machine::notb>);
+            bind(29, thunk<&Machine::neg>);
+            bind(30, thunk<&Machine::inc>);
+            bind(31, thunk<&Machine::dec>);
+            bind(32, thunk<&Machine::drop>);
+            bind(33, thunk<&Machine::dup>);
+            bind(34, thunk<&Machine::swap>);
+            bind(35, thunk<&Machine::pick>);
+            bind(36, thunk<&Machine::roll>);
+            bind(37, thunk<&Machine::clr>);
+            bind(38, thunk<&Machine::pushr>);
+            bind(39, thunk<&Machine::popr>);
+            bind(40, thunk<&Machine::peekr>);
+            bind(41, thunk<&Machine::forget>);
+            bind(42, thunk<&Machine::call>);
+            bind(43, thunk<&Machine::choice>);
+            bind(44, thunk<&Machine::chooseIf>);
+            bind(45, thunk<&Machine::loopTicks>);
+            bind(46, thunk<&Machine::setLoop>);
+            bind(47, thunk<&Machine::stopLoop>);
+            bind(48, thunk<&Machine::resetBoard>);
+            bind(49, thunk<&Machine::pinMode>);
+            bind(50, thunk<&Machine::digitalRead>);
+            bind(51, thunk<&Machine::digitalWrite>);
+            bind(52, thunk<&Machine::analogRead>);
+            bind(53, thunk<&Machine::analogWrite>);
+            bind(54, thunk<&Machine::attachISR>);
+            bind(55, thunk<&Machine::detachISR>);
+            bind(56, thunk<&Machine::milliseconds>);
+            bind(57, thunk<&Machine::pulseIn>);
+            bind(58, thunk<&Machine::next>);
+            bind(59, thunk<&Machine::nop>);
+            bind(60, thunk<&Machine::lit8Add>);
+            bind(61, thunk<&Machine::lit8Fetch16>);
+            bind(62, thunk<&Machine::dupMul>);
+            bind(63, thunk<&Machine::lit8DigitalRead>);
+            bind(64, thunk<&Machine::swapSub>);
+            bind(65, thunk<&Machine::zeroEq>);
+            bind(66, thunk<&Machine::zbranch>);
+            bind(67, thunk<&Machine::branch>);
+            bind(68, thunk<&Machine::extension>);
+            bind(69, thunk<&Machine::mulDiv>);
+            bind(70, thunk<&Machine::mulQ8>);
+            bind(71, thunk<&Machine::mulQ15>);
+            bind(72, thunk<&Machine::addSat>);
+            bind(73, thunk<&Machine::subSat>);
+            bind(74, thunk<&Machine::clamp>);
+            bind(75, thunk<&Machine::pinHandle>);
+            bind(76, thunk<&Machine::pinWrite>);
+            bind(77, thunk<&Machine::pinRead>);
+            bind(78, thunk<&Machine::pinToggle>);
+            bind(79, thunk<&Machine::portRead>);
+            bind(80, thunk<&Machine::portWrite>);
+            bind(81, thunk<&Machine::lit0>);
+            bind(82, thunk<&Machine::lit1>);
+            bind(83, thunk<&Machine::lit2>);
+            bind(84, thunk<&Machine::litNeg1>);
+            bind(85, thunk<&Machine::template vcall<0> >);
+            bind(86, thunk<&Machine::template vcall<1> >);
+            bind(87, thunk<&Machine::template vcall<2> >);
+            bind(88, thunk<&Machine::template vcall<3> >);
+            bind(89, thunk<&Machine::template vcall<4> >);
+            bind(90, thunk<&Machine::template vcall<5> >);
+            bind(91, thunk<&Machine::template vcall<6> >);
+            bind(92, thunk<&Machine::template vcall<7> >);
+
+            bindExtension(0, thunk<&Machine::eventsDropped>);
+            bindExtension(1, thunk<&Machine::setTelemetry>);
+            bindExtension(2, thunk<&Machine::telemetry>);
+            bindExtension(3, thunk<&Machine::flushTelemetry>);
+            bindExtension(4, thunk<&Machine::attachDeferredISR>);
+            bindExtension(5, thunk<&Machine::setTask>);
+            bindExtension(6, thunk<&Machine::stopTask>);
+            bindExtension(7, thunk<&Machine::yieldTask>);
+            bindExtension(8, thunk<&Machine::setLoopPeriod>);
+            bindExtension(9, thunk<&Machine::loopStats>);
+            bindExtension(10, thunk<&Machine::loopStatsEvent>);
+            bindExtension(11, thunk<&Machine::resetLoopStats>);
+            bindExtension(12, thunk<&Machine::resetProfile>);
+            bindExtension(13, thunk<&Machine::dumpProfile>);
+            bindExtension(14, thunk<&Machine::fill>);
+            bindExtension(15, thunk<&Machine::move>);
+            bindExtension(16, thunk<&Machine::vectorSum>);
+            bindExtension(17, thunk<&Machine::vectorMinMax>);
+            bindExtension(18, thunk<&Machine::vectorDot>);
+            bindExtension(19, thunk<&Machine::vectorAdd>);
+            bindExtension(20, thunk<&Machine::vectorScale>);
+            bindExtension(21, thunk<&Machine::average>);
+            bindExtension(22, thunk<&Machine::fir>);
+            bindExtension(23, thunk<&Machine::acquire>);
+            bindExtension(24, thunk<&Machine::acquireIndex>);
+            bindExtension(25, thunk<&Machine::telemetryBlock>);
+            bindExtension(26, thunk<&Machine::wireBegin>);
+            bindExtension(27, thunk<&Machine::wireReadBlock>);
+            bindExtension(28, thunk<&Machine::wireWriteBlock>);
+            bindExtension(29, thunk<&Machine::wireReadRegisters>);
+            bindExtension(30, thunk<&Machine::watchDigital>);
+            bindExtension(31, thunk<&Machine::watchAnalog>);
+            bindExtension(32, thunk<&Machine::watchThreshold>);
+            bindExtension(33, thunk<&Machine::unwatch>);
+#if PERSIST
+            bindExtension(34, thunk<&Machine::save>);
+            bindExtension(35, thunk<&Machine::restore>);
+            bindExtension(36, thunk<&Machine::forgetImage>);
+            bindExtension(37, thunk<&Machine::imageTag>);
+#endif
+#if BUDGET
+            bindExtension(38, thunk<&Machine::budget>);
+#endif
+            bindExtension(39, thunk<&Machine::resetTrace>);
+            bindExtension(40, thunk<&Machine::dumpTrace>);
+            bindExtension(41, thunk<&Machine::setVector>);
+
+            for (int16_t i = 0; i < MAX_INTERRUPTS; i++)
+            {
+                isrs[i] = -1;
+            }
+            for (uint8_t i = 0; i < CALL_VECTORS; i++) vectors[i] = -1;
+
+            resetLoopStats();
+            resetProfile();
+            resetTrace();
+            event(BOOT_EVENT_ID, 0); // boot event
+#if PERSIST && PERSIST_AUTO_RESTORE
+            if (restoreImage()) imageTag(); // resume saved image
+#endif
+        }
+
+        /* The payload from the PC to the MCU is in the form of Brief code. A header byte indicates
+        the length and whether the code is to be executed immediately (0x00) or appended to the
+        dictionary as a new definition (0x01).
+
+        A dictionary pointer is maintained at the MCU. This pointer always references the first
+        available free byte of dictionary space (beginning at address 0x0000). Each definition sent to
+        the MCU is appended to the end of the dictionary and advances the pointer. The bottom end of the
+        dictionary space is used for arguments (mainly for IL, not idiomatic Brief).
+
+        If code is a definition then it is expected to already be terminated by a `return` instruction (if
+        appropriate) and so we do nothing at all; just leave it in place and leave the `here` pointer
+        alone.
+
+        If code is to be executed immediately then a return instruction is appended and exec(...) is
+        called on it. The dictionary pointer (`here`) is restored; reclaiming this memory.
+
+        In either case, code failing verification (see VERIFY above) is discarded without running.
+
+        Frames are received incrementally. Each pass of `loop()` takes whatever bytes happen to be
+        available (without waiting for more), reading payload bytes in bulk into the dictionary at `here`
+        as they arrive. Only once a frame is complete is it committed or executed. Meanwhile the loop word
+        continues to run at full rate; a 127-byte frame would otherwise stall it for ~66ms at 19200 baud.
+        At most one frame is completed per pass.
+
+        Frames such as these are sent blind; nothing tells the PC of a frame lost or mangled by overrunning
+        the receive buffer. Bulk uploads may instead be sent as sequenced frames (ACKED_FRAMES), each
+        acknowledged through the event channel so that the PC may keep several in flight and retransmit
+        what fails. A sequenced frame is introduced by a zero header byte (otherwise an empty definition):
+
+          Header:   0x00
+          Flags:    bit 7 = execute immediately, bits 6-0 = sequence number (wrapping)
+          Length:   2 bytes (bit 15 = sync, bits 14-0 = payload length; beyond the 127 of a plain frame)
+          Check:    low byte of CRC-16/CCITT over flags and length
+          Payload:  code
+          CRC:      2 bytes (CRC-16/CCITT over flags, length and payload)
+
+        A frame arriving intact and in sequence is acknowledged by an ACK_EVENT_ID event carrying its
+        sequence number, then committed or executed as any other. Otherwise (bad CRC, out of sequence or
+        abandoned part way for FRAME_TIMEOUT) it is discarded and a single negative acknowledgement is sent
+        carrying 0x80 plus the sequence number expected. Frames after it are discarded silently until the
+        expected one arrives; the PC going back to resend from there. A duplicate (a frame resent because
+        its acknowledgement was lost) is acknowledged again without being run twice. The sync bit begins a
+        new numbering, taking the frame's sequence number as expected; sent by the PC with the first frame
+        after connecting. Frames too long for the dictionary are acknowledged but rejected (raising an out
+        of memory error) rather than being resent forever.
+
+        Having lost framing (e.g. to a dropped byte), the MCU hunts for the next sequenced frame; the header
+        check failing on false starts. So that a frame whose header byte was lost isn't taken for a plain
+        frame, plain frames are ignored once sequenced frames are in use, until the line falls quiet for
+        FRAME_TIMEOUT. */
+
+        int16_t frameRemaining = -1; // payload bytes yet to be received (-1 while awaiting header)
+        bool frameExec = false; // whether frame being received is to be executed immediately
+
+        static uint16_t crc16(uint16_t crc, uint8_t b) // CRC-16/CCITT (helper)
+        {
+            crc ^= (uint16_t)b << 8;
+            for (uint8_t i = 0; i < 8; i++) crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+            return crc;
+        }
+
+#if ACKED_FRAMES
+        bool frameSequenced = false; // whether frame being received is sequenced
+        bool frameDiscard = false; // whether payload is being dropped (no room)
+        bool frameSynced = false; // whether sequence numbering has begun
+        bool frameNaked = false; // whether the expected frame has been negatively acknowledged
+        bool frameSequencing = false; // whether sequenced frames are in use (plain frames ignored)
+        uint8_t frameHeader = 0; // header bytes (flags, length, check) yet to be received
+        uint8_t frameTrailer = 0; // CRC bytes yet to be received
+        uint8_t frameFlags; // execute flag and sequence number
+        uint8_t frameExpected = 0; // sequence number expected next
+        uint16_t frameLength; // sync flag and payload length
+        uint16_t frameCRC; // received
+        uint16_t frameCheck; // computed
+        unsigned long frameTime; // millis() as last byte was received
+
+        void acknowledge(uint8_t ack) // send acknowledgement (sequence number) or nak (0x80 | expected)
+        {
+            eventBegin(ACK_EVENT_ID, true);
+            eventPut(ack);
+            eventCommit();
+        }
+
+        void nak() // negative acknowledgement of expected frame (once)
+        {
+            if (frameNaked) return;
+            frameNaked = true;
+            acknowledge(0x80 | frameExpected);
+        }
+
+        void abandon() // discard sequenced frame and hunt for the next
+        {
+            frameSequenced = false;
+            frameRemaining = -1;
+            here = last;
+            nak();
+        }
+
+        bool receiveSequenced(int16_t available) // receive sequenced frame, true once complete and in order
+        {
+            frameTime = millis();
+            if (frameHeader > 0) // flags, length and check
+            {
+                uint8_t b = transport->read();
+                if (--frameHeader > 0)
+                {
+                    frameCheck = crc16(frameCheck, b);
+                    if (frameHeader == 3) frameFlags = b;
+                    else frameLength = frameLength << 8 | b;
+                }
+                else if (b == (uint8_t)frameCheck)
+                {
+                    frameRemaining = frameLength & 0x7FFF;
+                    frameDiscard = (int32_t)here + frameRemaining + 1 > MemSize; // room for appended return
+                    frameTrailer = 2;
+                }
+                else abandon(); // false start
+                return false;
+            }
+
+            if (frameRemaining > 0) // payload
+            {
+                int16_t n = available < frameRemaining ? available : frameRemaining;
+                if (frameDiscard)
+                {
+                    for (int16_t i = 0; i < n; i++) frameCheck = crc16(frameCheck, transport->read());
+                }
+                else
+                {
+                    n = transport->readBytes((char*)&memory[here], n); // bulk
+                    for (int16_t i = 0; i < n; i++) frameCheck = crc16(frameCheck, memory[here++]);
+                }
+                frameRemaining -= n;
+                return false;
+            }
+
+            frameCRC = frameCRC << 8 | transport->read();
+            if (--frameTrailer > 0) return false;
+            if (frameCRC != frameCheck)
+            {
+                abandon(); // mangled
+                return false;
+            }
+            frameSequenced = false;
+            frameRemaining = -1;
+
+            uint8_t seq = frameFlags & 0x7F;
+            if ((frameLength & 0x8000) && !(frameSynced && seq == ((frameExpected - 1) & 0x7F)))
+            {
+                frameExpected = seq; // sync (unless a resend of the sync frame already taken)
+                frameSynced = true;
+            }
+            if (frameSynced && seq == frameExpected)
+            {
+                frameExpected = (seq + 1) & 0x7F;
+                frameNaked = false;
+                acknowledge(seq);
+                if (!frameDiscard)
+                {
+                    frameExec = (frameFlags & 0x80) == 0x80;
+                    return true;
+                }
+                error(VM_ERROR_OUT_OF_MEMORY); // too long (acknowledged, but rejected)
+            }
+            else if (frameSynced && ((frameExpected - seq) & 0x7F) < 64)
+            {
+                acknowledge((frameExpected - 1) & 0x7F); // duplicate (acknowledgement lost)
+            }
+            else nak(); // out of sequence
+            here = last;
+            return false;
+        }
+#endif
+
+        void loop()
+        {
+            runDeferred(); // interrupt words
+            pollISREvents();
+            pollAcquire();
+            pollWatches();
+            pollTelemetry();
+            pollProfile();
+            pollTrace();
+            drain(); // queued events
+
+            int16_t available;
+            while ((available = transport->available()) > 0)
+            {
+#if ACKED_FRAMES
+                if (frameSequenced)
+                {
+                    if (!receiveSequenced(available)) continue; // frame incomplete (or discarded)
+                }
+                else
+#endif
+                {
+                    if (frameRemaining < 0) // header
+                    {
+                        uint8_t b = transport->read();
+#if ACKED_FRAMES
+                        if (b == 0) // sequenced frame
+                        {
+                            frameSequenced = true;
+                            frameSequencing = true;
+                            frameHeader = 4;
+                            frameLength = 0;
+                            frameCheck = 0xFFFF;
+                            frameTime = millis();
+                            continue;
+                        }
+                        if (frameSequencing) // plain frame header or lost framing (ignored)
+                        {
+                            frameTime = millis();
+                            continue;
+                        }
+#endif
+                        frameExec = (b & 0x80) == 0x80;
+                        frameRemaining = b & 0x7f;
+                    }
+                    else
+                    {
+                        int16_t n = available < frameRemaining ? available : frameRemaining;
+                        if (here + n <= MemSize)
+                        {
+                            n = transport->readBytes((char*)&memory[here], n); // bulk
+                        }
+                        else
+                        {
+                            memset(here, transport->read()); // raises OOM
+                            n = 1;
+                        }
+                        here += n;
+                        frameRemaining -= n;
+                    }
+
+                    if (frameRemaining != 0) continue; // frame incomplete
+                    frameRemaining = -1;
+                }
+
+                if (frameExec)
+                {
+                    memset(here++, 0); // ensure return
+                    bool valid = verify(last, here);
+                    here = last;
+                    if (valid)
+                    {
+                        exec(here);
+                        unverify(here); // immediate mode code not remembered
+                    }
+                }
+                else
+                {
+                    if (verify(last, here)) last = here;
+                    else here = last; // rejected
+                }
+                break;
+            }
+
+#if ACKED_FRAMES
+            if (frameSequencing && millis() - frameTime > FRAME_TIMEOUT) // line quiet
+            {
+                if (frameSequenced) abandon(); // part way
+                frameSequencing = false;
+            }
+#endif
+
+#if BUDGET
+            preempt = true;
+            if (!resume() && loopword >= 0) runLoop();
+#else
+            if (loopword >= 0) runLoop();
+#endif
+
+            if (tasks != 0) runTasks();
+#if BUDGET
+            preempt = false;
+#endif
+        }
+    };
+
+    // static members (one per instantiation)
+
+    template <uint16_t MemSize, uint8_t DataStackSize, uint8_t ReturnStackSize, typename Cell>
+    Machine<MemSize, DataStackSize, ReturnStackSize, Cell>*
+        Machine<MemSize, DataStackSize, ReturnStackSize, Cell>::current = 0;
+
+    template <uint16_t MemSize, uint8_t DataStackSize, uint8_t ReturnStackSize, typename Cell>
+    Machine<MemSize, DataStackSize, ReturnStackSize, Cell>*
+        Machine<MemSize, DataStackSize, ReturnStackSize, Cell>::onReceiveMachine = 0;
+
+    template <uint16_t MemSize, uint8_t DataStackSize, uint8_t ReturnStackSize, typename Cell>
+    Machine<MemSize, DataStackSize, ReturnStackSize, Cell>*
+        Machine<MemSize, DataStackSize, ReturnStackSize, Cell>::onRequestMachine = 0;
+
+    template <uint16_t MemSize, uint8_t DataStackSize, uint8_t ReturnStackSize, typename Cell>
+    Machine<MemSize, DataStackSize, ReturnStackSize, Cell>*
+        Machine<MemSize, DataStackSize, ReturnStackSize, Cell>::interruptMachines[MAX_INTERRUPTS];
+}
+
+#endif // BRIEF_VM_H